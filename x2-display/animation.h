@@ -0,0 +1,46 @@
+#ifndef _animation_h_
+#define _animation_h_
+
+#include <inttypes.h>
+
+
+/*
+ * Animation file format, for on-device playback with x2-display -a.
+ * All fields are little-endian (native on both the BBB and x86 hosts).
+ *
+ * An animation_header_t, then num_frames animation_frame_t index entries,
+ * then the frames.  A frame whose length is the panel size (width * height
+ * BRGA pixels) is stored raw, at a page aligned offset so that it can be
+ * drawn straight out of the mapped file; any other length is run-length
+ * encoded in 4 byte pixels:
+ *
+ *   control byte c < 128:  c + 1 literal pixels follow
+ *   control byte c >= 128: the following pixel repeats c - 126 times
+ *
+ * x2-pack writes these files from a sequence of images.
+ */
+
+#define ANIMATION_MAGIC "X2AN"
+#define ANIMATION_VERSION 1
+#define ANIMATION_ALIGN 4096
+
+#define RLE_MAX_LITERAL 128
+#define RLE_MAX_RUN 129
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t width;       // panel columns
+  uint32_t height;      // panel rows
+  uint32_t num_frames;
+  uint32_t reserved;
+} __attribute__((__packed__)) animation_header_t;
+
+typedef struct {
+  uint64_t offset;         // from the start of the file
+  uint32_t length;         // bytes stored
+  uint32_t duration_usec;  // how long the frame is shown
+} __attribute__((__packed__)) animation_frame_t;
+
+
+#endif
@@ -0,0 +1,162 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "calibration.h"
+#include "color.h"
+#include "config.h"
+#include "err.h"
+#include "geometry.h"
+
+
+#define MAX_LINE 256
+#define UNITY_GAIN (1 << 8)
+
+
+const char *calibration_path;
+
+// as with panels, the table the drawing thread is rendering the rotation
+// with, the latest one, which it takes at the next rotation, and a third
+// that is neither, loaded on reload
+led_calibration_t *tables[3];
+const led_calibration_t *drawn_table;    // protected by calibration_lock
+const led_calibration_t *current_table;  // protected by calibration_lock
+pthread_mutex_t calibration_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+void set_led(led_calibration_t *led, const double *gains, const double *offsets) {
+  for (int c = 0; c < 3; c++) {
+    double offset = offsets[c] < 0 ? 0 : offsets[c] > 255 ? 255 : offsets[c];
+    double gain = gains[c] < 0 ? 0 : gains[c];
+    // rounded down at the cap, so that full brightness plus the offset
+    // stays within 255 when dithered rather than wrapping to 0
+    double max_gain = floor((255 - offset) / 255 * UNITY_GAIN);
+    led->offset[c] = offset * (1 << COLOR_BITS);
+    led->gain[c] = gain * UNITY_GAIN + 0.5 > max_gain ? max_gain : gain * UNITY_GAIN + 0.5;
+  }
+}
+
+/*
+ * Read the calibration file into table, starting from no calibration.
+ * Returns false, having reported why, if it has errors.
+ */
+bool read_calibration(led_calibration_t *table) {
+  const unsigned int num_leds = geometry.num_strips * geometry.pixels_per_strip;
+  const double unity[3] = { 1, 1, 1 };
+  const double zero[3] = { 0, 0, 0 };
+  for (unsigned int i = 0; i < num_leds; i++)
+    set_led(&table[i], unity, zero);
+
+  FILE *f = fopen(calibration_path, "r");
+  if (f == NULL) {
+    perror(calibration_path);
+    return false;
+  }
+
+  char line[MAX_LINE];
+  int line_num = 0;
+  bool ok = true;
+  unsigned int num_set = 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    line_num++;
+    char *comment = strchr(line, '#');
+    if (comment != NULL)
+      *comment = '\0';
+
+    unsigned int strip;
+    char pixel[16];
+    int n;
+    if (sscanf(line, " %u %15s%n", &strip, pixel, &n) != 2) {
+      if (strspn(line, " \t\r\n") != strlen(line)) {
+        fprintf(stderr, "%s:%d: expected strip, pixel and gains\n", calibration_path, line_num);
+        ok = false;
+      }
+      continue;
+    }
+
+    unsigned int first = 0, last = geometry.pixels_per_strip - 1;
+    char *end = pixel + strlen(pixel);
+    if (strcmp(pixel, "*") != 0)
+      first = last = strtoul(pixel, &end, 10);
+    if (*end != '\0' || strip >= geometry.num_strips || last >= geometry.pixels_per_strip) {
+      fprintf(stderr, "%s:%d: no LED %u %s\n", calibration_path, line_num, strip, pixel);
+      ok = false;
+      continue;
+    }
+
+    double gains[3], offsets[3] = { 0, 0, 0 };
+    char word[4];
+    const char *rest = line + n;
+    if (sscanf(rest, " %3s", word) == 1 && strcmp(word, "off") == 0) {
+      memcpy(gains, zero, sizeof(gains));
+    } else {
+      int count = sscanf(rest, " %lf %lf %lf %lf %lf %lf",
+          &gains[0], &gains[1], &gains[2], &offsets[0], &offsets[1], &offsets[2]);
+      if (count != 3 && count != 6) {
+        fprintf(stderr, "%s:%d: expected 3 gains and optionally 3 offsets, or off\n", calibration_path, line_num);
+        ok = false;
+        continue;
+      }
+    }
+
+    for (unsigned int p = first; p <= last; p++)
+      set_led(&table[strip * geometry.pixels_per_strip + p], gains, offsets);
+    num_set += last - first + 1;
+  }
+  fclose(f);
+
+  if (ok)
+    printf("Calibrated %u LEDs from %s\n", num_set, calibration_path);
+  return ok;
+}
+
+/*
+ * (Re)load the calibration file into the spare table, and hand it to the
+ * drawing thread.  Only one thread may load at a time.
+ */
+bool calibration_load() {
+  if (calibration_path == NULL)
+    return true;
+
+  pthread_mutex_lock(&calibration_lock);
+  int spare = 0;
+  while (tables[spare] == drawn_table || tables[spare] == current_table)
+    spare++;
+  pthread_mutex_unlock(&calibration_lock);
+
+  if (!read_calibration(tables[spare]))
+    return false;
+  pthread_mutex_lock(&calibration_lock);
+  current_table = tables[spare];
+  pthread_mutex_unlock(&calibration_lock);
+  return true;
+}
+
+// Take the calibration to render the next rotation with, by strip then
+// pixel; only the drawing thread calls this, at the start of each rotation.
+const led_calibration_t *calibration() {
+  pthread_mutex_lock(&calibration_lock);
+  drawn_table = current_table;
+  pthread_mutex_unlock(&calibration_lock);
+  return drawn_table;
+}
+
+void calibration_init() {
+  const unsigned int num_leds = geometry.num_strips * geometry.pixels_per_strip;
+  for (int i = 0; i < 3; i++) {
+    tables[i] = malloc(num_leds * sizeof(led_calibration_t));
+    if (tables[i] == NULL)
+      error("ERROR allocating calibration");
+  }
+
+  // no calibration until the file is read
+  const double unity[3] = { 1, 1, 1 };
+  const double zero[3] = { 0, 0, 0 };
+  for (unsigned int i = 0; i < num_leds; i++)
+    set_led(&tables[0][i], unity, zero);
+  drawn_table = current_table = tables[0];
+
+  calibration_path = config_string("calibration", NULL);
+  calibration_load();
+}
@@ -0,0 +1,43 @@
+#ifndef _calibration_h_
+#define _calibration_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+
+/*
+ * Per-LED colour calibration, from the file named by the calibration
+ * setting.  Each line is
+ *
+ *   <strip> <pixel> <r-gain> <g-gain> <b-gain> [<r-offset> <g-offset> <b-offset>]
+ *   <strip> <pixel> off
+ *
+ * where strip is the strip index as in the strip map, pixel counts along the
+ * strip from its data input, or is * for the whole strip, gains are factors
+ * and offsets are levels from 0 to 255 added after colour correction.  Gains are capped so
+ * that full brightness plus the offset is still full brightness, so the
+ * render kernels apply every LED's calibration with a multiply and an add
+ * and no branches; LEDs that are off have zero gain and offset.
+ *
+ * SIGHUP reloads the file; a file with errors leaves the calibration as it
+ * was.
+ */
+
+typedef struct {
+  uint16_t gain[3];    // r, g, b, out of 1 << 8
+  uint16_t offset[3];  // in colour table units
+} led_calibration_t;
+
+
+extern void calibration_init();
+extern bool calibration_load();
+extern const led_calibration_t *calibration();
+
+
+// a colour table entry calibrated for an LED
+static inline uint32_t calibrate(uint32_t value, const led_calibration_t *cal, unsigned int channel) {
+  return cal->offset[channel] + ((value * cal->gain[channel]) >> 8);
+}
+
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Records every frame sent to the LEDs, tagged with its rotation, slice index
+ * and timestamp, so that x2-preview can reconstruct what the sphere showed.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "capture.h"
+#include "drawing.h"
+#include "err.h"
+#include "geometry.h"
+#include "strip-map.h"
+
+
+#define CAPTURE_BUFSIZE (1024 * 1024)
+
+
+// externs
+bool capturing = false;
+
+
+FILE *capture_file;
+char capture_buf[CAPTURE_BUFSIZE];
+
+
+void capture_open(const char *path) {
+  capture_file = fopen(path, "wb");
+  if (capture_file == NULL)
+    error("ERROR opening capture file");
+  setvbuf(capture_file, capture_buf, _IOFBF, sizeof(capture_buf));
+
+  capture_header_t header = {
+    .magic = CAPTURE_MAGIC,
+    .version = CAPTURE_VERSION,
+    .num_strips = LEDSCAPE_NUM_STRIPS,
+    .num_pixels = geometry.pixels_per_strip,
+    .num_slices = geometry.num_slices,
+    .strips_per_row = geometry.num_arms,
+  };
+  fwrite(&header, sizeof(header), 1, capture_file);
+  for (int strip_idx = 0; strip_idx < LEDSCAPE_NUM_STRIPS; strip_idx++) {
+    int32_t lane = strip_idx < (int) geometry.num_strips ? strip_map[strip_idx] : -1;
+    fwrite(&lane, sizeof(lane), 1, capture_file);
+  }
+
+  printf("Capturing frames to %s\n", path);
+  capturing = true;
+}
+
+void capture_frame(const ledscape_frame_t *frame, uint32_t rotation, uint32_t slice_idx, uint32_t num_slices, uint64_t timestamp_usec) {
+  capture_record_t record = {
+    .timestamp_usec = timestamp_usec,
+    .rotation = rotation,
+    .slice_idx = slice_idx,
+    .num_slices = num_slices,
+  };
+  fwrite(&record, sizeof(record), 1, capture_file);
+  if (fwrite(frame, geometry.frame_size, 1, capture_file) != 1)
+    error("ERROR writing capture file");
+}
+
+void capture_close() {
+  if (!capturing)
+    return;
+  capturing = false;
+  fclose(capture_file);
+}
@@ -0,0 +1,46 @@
+#ifndef _capture_h_
+#define _capture_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "ledscape.h"
+
+
+/*
+ * Capture file format, for offline preview with x2-preview.
+ * All fields are little-endian (native on both the BBB and x86 hosts).
+ *
+ * A capture_header_t, then num_strips int32 entries of the strip map in
+ * effect, then one capture_record_t per frame handed to ledscape_draw, each
+ * followed by the raw frame (num_pixels * num_strips BRGA pixels).
+ */
+
+#define CAPTURE_MAGIC "X2CP"
+#define CAPTURE_VERSION 2
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t num_strips;     // strips per frame, LEDSCAPE_NUM_STRIPS
+  uint32_t num_pixels;     // pixels per strip
+  uint32_t num_slices;     // panel columns per rotation
+  uint32_t strips_per_row; // arms around the axis, one per quadrant
+} __attribute__((__packed__)) capture_header_t;
+
+typedef struct {
+  uint64_t timestamp_usec;
+  uint32_t rotation;
+  uint32_t slice_idx;
+  uint32_t num_slices;     // slices drawn in this rotation
+} __attribute__((__packed__)) capture_record_t;
+
+
+extern bool capturing;
+
+
+extern void capture_open(const char *path);
+extern void capture_frame(const ledscape_frame_t *frame, uint32_t rotation, uint32_t slice_idx, uint32_t num_slices, uint64_t timestamp_usec);
+extern void capture_close();
+
+
+#endif
@@ -0,0 +1,578 @@
+/*
+ * Cluster mode; see cluster.h.
+ *
+ * Datagrams start with "X2CL", a u8 type and 3 reserved bytes, followed by
+ * little-endian fields:
+ *
+ *   CHUNK       coordinator to nodes: u64 panel id, u32 offset, u32 length
+ *               of the panel as stored, then up to CHUNK_SIZE of its bytes
+ *   SHOW        coordinator to nodes: u64 panel id, u64 presentation time
+ *               in usec on the coordinator's clock, u32 sequence number
+ *   SYNC        node to coordinator: u64 node time t0
+ *   SYNC_REPLY  coordinator to node: u64 t0, u64 coordinator time t1
+ *   REPORT      node to coordinator: u32 sequence number, i64 usec the node
+ *               swapped the panel in after its presentation time
+ *   REQUEST     node to coordinator: u64 id of a panel the node was told to
+ *               show but does not have, which the coordinator sends it again
+ *
+ * A node takes the offset from the sync exchange with the shortest round
+ * trip of the last SYNC_SAMPLES, which is the one least skewed by queueing.
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "cluster.h"
+#include "config.h"
+#include "constants.h"
+#include "drawing.h"
+#include "err.h"
+#include "geometry.h"
+#include "panel-cache.h"
+#include "protocol.h"
+#include "timing.h"
+#include "x2-server.h"
+
+
+#define CLUSTER_MAGIC "X2CL"
+#define HEADER_SIZE 8
+#define MSG_CHUNK 1
+#define MSG_SHOW 2
+#define MSG_SYNC 3
+#define MSG_SYNC_REPLY 4
+#define MSG_REPORT 5
+#define MSG_REQUEST 6
+
+#define CHUNK_SIZE 1400  // fits an Ethernet frame
+#define CHUNK_HEADER_SIZE 16
+#define MAX_DATAGRAM (HEADER_SIZE + CHUNK_HEADER_SIZE + CHUNK_SIZE)
+#define MAX_NODES 16
+#define MAX_PENDING 8       // shows not yet due
+#define MAX_ASSEMBLIES 4    // panels being received
+#define NUM_SKEW_RECORDS 16
+#define SYNC_SAMPLES 8
+#define FAST_SYNC_USEC (USEC_PER_SECOND / 10)  // until there are SYNC_SAMPLES
+#define SYNC_USEC USEC_PER_SECOND
+#define SWAP_POLL_MSEC 2
+#define SWAP_TIMEOUT_USEC (2 * USEC_PER_SECOND)
+#define SOCKET_BUFFER (1 << 20)
+#define DEFAULT_CLUSTER_PORT 10002
+#define DEFAULT_CLUSTER_DELAY_MSEC 100
+
+
+// externs
+bool coordinating = false;
+double cluster_skew = 0;
+double cluster_clock_offset = 0;
+double cluster_swap_error = 0;
+
+
+typedef struct {
+  uint32_t seq;
+  uint64_t id;
+  uint64_t present_usec;  // coordinator clock
+} show_t;
+
+typedef struct {
+  uint64_t id;
+  uint32_t len;
+  uint8_t *data;  // NULL if the slot is free
+  uint8_t *got;   // chunks received
+  unsigned int remaining;
+  uint64_t start_usec;
+} assembly_t;
+
+typedef struct {
+  uint32_t seq;
+  int64_t min_error;
+  int64_t max_error;
+  unsigned int count;
+} skew_record_t;
+
+
+bool clustering = false;
+int cluster_sock = -1;
+uint64_t delay_usec;
+
+// coordinator
+struct sockaddr_in destinations[MAX_NODES];
+unsigned int num_destinations = 0;
+uint32_t show_seq = 0;
+skew_record_t skews[NUM_SKEW_RECORDS];
+double skew_total = 0;
+double skew_max = 0;
+unsigned int skew_count = 0;
+
+// node
+struct sockaddr_in coordinator;
+bool coordinator_known = false;
+assembly_t assemblies[MAX_ASSEMBLIES];
+struct { uint64_t rtt; int64_t offset; } sync_samples[SYNC_SAMPLES];
+unsigned int num_sync_samples = 0;
+unsigned int next_sync_sample = 0;
+uint64_t next_sync_usec = 0;
+int64_t offset_usec = 0;  // coordinator clock less ours
+
+// both
+show_t pending[MAX_PENDING];
+unsigned int num_pending = 0;
+bool awaiting = false;  // a shown panel to see swapped in
+show_t awaited;
+uint32_t awaited_shown;  // panels_shown once it was shown
+uint64_t awaited_since;
+unsigned int shows_missed = 0;
+
+
+bool parse_address(const char *text, struct sockaddr_in *addr) {
+  char host[256];
+  int port = DEFAULT_CLUSTER_PORT;
+  const char *colon = strrchr(text, ':');
+  size_t host_len = colon ? (size_t) (colon - text) : strlen(text);
+  if (host_len >= sizeof(host))
+    return false;
+  memcpy(host, text, host_len);
+  host[host_len] = '\0';
+  if (colon)
+    port = atoi(colon + 1);
+
+  struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM };
+  struct addrinfo *res;
+  if (getaddrinfo(host, NULL, &hints, &res) != 0)
+    return false;
+  *addr = *(struct sockaddr_in *) res->ai_addr;
+  addr->sin_port = htons(port);
+  freeaddrinfo(res);
+  return true;
+}
+
+void cluster_init() {
+  const char *role = config_string("cluster", "off");
+  if (strcmp(role, "off") == 0)
+    return;
+  if (strcmp(role, "coordinator") == 0)
+    coordinating = true;
+  else if (strcmp(role, "node") != 0)
+    error("ERROR cluster must be off, coordinator or node");
+  clustering = true;
+  delay_usec = config_int("cluster_delay_ms", DEFAULT_CLUSTER_DELAY_MSEC) * 1000ULL;
+
+  cluster_sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (cluster_sock < 0)
+    error("ERROR opening cluster socket");
+  int optval = 1;
+  setsockopt(cluster_sock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+  int buffer = SOCKET_BUFFER;
+  setsockopt(cluster_sock, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+  setsockopt(cluster_sock, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+  fcntl(cluster_sock, F_SETFL, O_NONBLOCK);
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(config_int("cluster_port", DEFAULT_CLUSTER_PORT));
+  if (bind(cluster_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    error("ERROR binding cluster socket");
+
+  if (coordinating) {
+    char *nodes = strdup(config_string("cluster_nodes", ""));
+    char *saveptr = NULL;
+    for (char *node = strtok_r(nodes, " \t,", &saveptr); node; node = strtok_r(NULL, " \t,", &saveptr)) {
+      if (num_destinations == MAX_NODES || !parse_address(node, &destinations[num_destinations])) {
+        fprintf(stderr, "Bad or too many cluster_nodes: %s\n", node);
+        exit(1);
+      }
+      num_destinations++;
+    }
+    free(nodes);
+    printf("Coordinating %u cluster nodes, presenting %" PRIu64 " ms ahead\n", num_destinations, delay_usec / 1000);
+  } else {
+    // otherwise learnt from the first datagram from it
+    const char *address = config_string("cluster_coordinator", NULL);
+    if (address) {
+      if (!parse_address(address, &coordinator)) {
+        fprintf(stderr, "Bad cluster_coordinator: %s\n", address);
+        exit(1);
+      }
+      coordinator_known = true;
+    }
+
+    const char *group = config_string("cluster_group", NULL);
+    if (group) {
+      struct ip_mreq mreq = { .imr_interface.s_addr = htonl(INADDR_ANY) };
+      if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1 ||
+          setsockopt(cluster_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        error("ERROR joining cluster_group");
+    }
+    printf("Cluster node on port %d\n", ntohs(addr.sin_port));
+  }
+}
+
+int cluster_fd() {
+  return cluster_sock;
+}
+
+uint8_t *message(uint8_t *buf, unsigned int type) {
+  memcpy(buf, CLUSTER_MAGIC, 4);
+  buf[4] = type;
+  buf[5] = buf[6] = buf[7] = 0;
+  return buf + HEADER_SIZE;
+}
+
+void send_to(const struct sockaddr_in *to, const uint8_t *buf, size_t len) {
+  // a full socket buffer loses the datagram, as the network might
+  sendto(cluster_sock, buf, len, 0, (const struct sockaddr *) to, sizeof(*to));
+}
+
+void send_to_nodes(const uint8_t *buf, size_t len) {
+  for (unsigned int i = 0; i < num_destinations; i++)
+    send_to(&destinations[i], buf, len);
+}
+
+// Send a panel to a node's cache, or every node's if to is NULL; only the
+// coordinator does.
+void send_panel(const struct sockaddr_in *to, uint64_t id, const uint8_t *data, uint32_t len) {
+  uint8_t buf[MAX_DATAGRAM];
+  uint8_t *p = message(buf, MSG_CHUNK);
+  for (uint32_t offset = 0; offset < len; offset += CHUNK_SIZE) {
+    uint32_t n = len - offset < CHUNK_SIZE ? len - offset : CHUNK_SIZE;
+    put_u64(p, id);
+    put_u32(p + 8, offset);
+    put_u32(p + 12, len);
+    memcpy(p + CHUNK_HEADER_SIZE, data + offset, n);
+    if (to)
+      send_to(to, buf, HEADER_SIZE + CHUNK_HEADER_SIZE + n);
+    else
+      send_to_nodes(buf, HEADER_SIZE + CHUNK_HEADER_SIZE + n);
+  }
+}
+
+void cluster_send_panel(uint64_t id, const uint8_t *data, uint32_t len) {
+  send_panel(NULL, id, data, len);
+}
+
+// Queue a show for our sphere.
+void add_pending(const show_t *show) {
+  if (num_pending == MAX_PENDING) {
+    memmove(pending, pending + 1, (MAX_PENDING - 1) * sizeof(show_t));
+    num_pending--;
+    shows_missed++;
+  }
+  pending[num_pending++] = *show;
+}
+
+// A node only knows when shows are due once it has an offset to the
+// coordinator's clock; until then they wait.
+bool synced() {
+  return coordinating || num_sync_samples > 0;
+}
+
+// When to show a panel on our clock, so that the drawing thread swaps it in
+// at the rotation boundary nearest its presentation time.
+uint64_t due_usec(const show_t *show) {
+  return show->present_usec - offset_usec - rotation_usec / 2;
+}
+
+// Present a cached panel across the cluster; only the coordinator does.
+void present(uint64_t id) {
+  show_t show = { .seq = ++show_seq, .id = id, .present_usec = gettime() + delay_usec };
+  uint8_t buf[HEADER_SIZE + 20];
+  uint8_t *p = message(buf, MSG_SHOW);
+  put_u64(p, show.id);
+  put_u64(p + 8, show.present_usec);
+  put_u32(p + 16, show.seq);
+  send_to_nodes(buf, sizeof(buf));
+  add_pending(&show);
+}
+
+/*
+ * Present a panel the server received across the cluster.  Returns false
+ * if we are not the coordinator, or the panel cache could not take it, and
+ * it should just be shown.
+ */
+bool cluster_present(const uint8_t *panel) {
+  uint64_t id;
+  if (!coordinating || !panel_cache_store(panel, geometry.panel_size, &id))
+    return false;
+  cluster_send_panel(id, panel, geometry.panel_size);
+  present(id);
+  return true;
+}
+
+// Present a cached panel across the cluster.  Returns false if it is not cached.
+bool cluster_present_cached(uint64_t id) {
+  if (panel_cache_panel(id, NULL) == NULL)
+    return false;
+  present(id);
+  return true;
+}
+
+// Account for how late a sphere swapped in panel seq; only the coordinator does.
+void record_error(uint32_t seq, int64_t error_usec) {
+  skew_record_t *r = &skews[seq % NUM_SKEW_RECORDS];
+  if (r->seq != seq) {
+    if ((int32_t) (seq - r->seq) < 0)
+      return;  // too old
+    if (r->count >= 2) {
+      double skew = (r->max_error - r->min_error) / (double) USEC_PER_SECOND;
+      skew_total += skew;
+      skew_count++;
+      if (skew > skew_max)
+        skew_max = skew;
+    }
+    *r = (skew_record_t) { .seq = seq, .min_error = error_usec, .max_error = error_usec, .count = 0 };
+  }
+
+  if (error_usec < r->min_error)
+    r->min_error = error_usec;
+  if (error_usec > r->max_error)
+    r->max_error = error_usec;
+  if (++r->count >= 2)
+    cluster_skew = (r->max_error - r->min_error) / (double) USEC_PER_SECOND;
+}
+
+void receive_chunk(const uint8_t *p, size_t len) {
+  if (len < CHUNK_HEADER_SIZE)
+    return;
+  uint64_t id = get_u64(p);
+  uint32_t offset = get_u32(p + 8);
+  uint32_t total = get_u32(p + 12);
+  uint32_t n = len - CHUNK_HEADER_SIZE;
+  if (total == 0 || total > geometry.panel_size || offset % CHUNK_SIZE != 0 || offset >= total ||
+      n != (total - offset < CHUNK_SIZE ? total - offset : CHUNK_SIZE))
+    return;
+
+  // the panel's slot, or a free one, or the oldest
+  assembly_t *a = NULL;
+  for (unsigned int i = 0; i < MAX_ASSEMBLIES; i++) {
+    assembly_t *s = &assemblies[i];
+    if (s->data && s->id == id && s->len == total) {
+      a = s;
+      break;
+    }
+    if (a == NULL || (a->data && (s->data == NULL || s->start_usec < a->start_usec)))
+      a = s;
+  }
+  if (a->data == NULL || a->id != id || a->len != total) {
+    unsigned int num_chunks = (total + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    free(a->data);
+    free(a->got);
+    *a = (assembly_t) {
+      .id = id, .len = total, .data = malloc(total), .got = calloc(num_chunks, 1),
+      .remaining = num_chunks, .start_usec = gettime(),
+    };
+    if (a->data == NULL || a->got == NULL)
+      error("ERROR allocating cluster panel");
+  }
+
+  unsigned int chunk = offset / CHUNK_SIZE;
+  if (a->got[chunk])
+    return;
+  a->got[chunk] = 1;
+  memcpy(a->data + offset, p + CHUNK_HEADER_SIZE, n);
+  if (--a->remaining > 0)
+    return;
+
+  uint64_t stored;
+  if (!panel_cache_store(a->data, a->len, &stored) || stored != id)
+    fprintf(stderr, "Cluster panel %016" PRIx64 " could not be cached\n", id);
+  free(a->data);
+  free(a->got);
+  a->data = a->got = NULL;
+}
+
+void receive_sync_reply(const uint8_t *p) {
+  uint64_t t2 = gettime();
+  uint64_t t0 = get_u64(p);
+  uint64_t t1 = get_u64(p + 8);
+  if (t2 < t0)
+    return;
+
+  sync_samples[next_sync_sample].rtt = t2 - t0;
+  sync_samples[next_sync_sample].offset = (int64_t) t1 - (int64_t) (t0 + (t2 - t0) / 2);
+  next_sync_sample = (next_sync_sample + 1) % SYNC_SAMPLES;
+  if (num_sync_samples < SYNC_SAMPLES)
+    num_sync_samples++;
+
+  unsigned int best = 0;
+  for (unsigned int i = 1; i < num_sync_samples; i++)
+    if (sync_samples[i].rtt < sync_samples[best].rtt)
+      best = i;
+  offset_usec = sync_samples[best].offset;
+  cluster_clock_offset = offset_usec / (double) USEC_PER_SECOND;
+}
+
+void receive(const uint8_t *buf, size_t len, const struct sockaddr_in *from) {
+  if (len < HEADER_SIZE || memcmp(buf, CLUSTER_MAGIC, 4) != 0)
+    return;
+  const uint8_t *p = buf + HEADER_SIZE;
+  len -= HEADER_SIZE;
+
+  switch (buf[4]) {
+  case MSG_CHUNK:
+    if (!coordinating) {
+      coordinator = *from;
+      coordinator_known = true;
+      receive_chunk(p, len);
+    }
+    break;
+  case MSG_SHOW:
+    if (!coordinating && len >= 20) {
+      coordinator = *from;
+      coordinator_known = true;
+      show_t show = { .id = get_u64(p), .present_usec = get_u64(p + 8), .seq = get_u32(p + 16) };
+      add_pending(&show);
+      // lost, or stored before we joined; it usually comes back before it is due
+      if (panel_cache_panel(show.id, NULL) == NULL) {
+        uint8_t request[HEADER_SIZE + 8];
+        put_u64(message(request, MSG_REQUEST), show.id);
+        send_to(from, request, sizeof(request));
+      }
+    }
+    break;
+  case MSG_REQUEST:
+    if (coordinating && len >= 8) {
+      uint32_t panel_len;
+      const uint8_t *panel = panel_cache_panel(get_u64(p), &panel_len);
+      if (panel)
+        send_panel(from, get_u64(p), panel, panel_len);
+    }
+    break;
+  case MSG_SYNC:
+    if (coordinating && len >= 8) {
+      uint8_t reply[HEADER_SIZE + 16];
+      uint8_t *r = message(reply, MSG_SYNC_REPLY);
+      put_u64(r, get_u64(p));
+      put_u64(r + 8, gettime());
+      send_to(from, reply, sizeof(reply));
+    }
+    break;
+  case MSG_SYNC_REPLY:
+    if (!coordinating && len >= 16)
+      receive_sync_reply(p);
+    break;
+  case MSG_REPORT:
+    if (coordinating && len >= 12)
+      record_error(get_u32(p), (int64_t) get_u64(p + 4));
+    break;
+  }
+}
+
+// Our sphere swapped in the awaited panel at swap_usec, on our clock.
+void swapped(uint64_t swap_usec) {
+  int64_t error_usec = (int64_t) (swap_usec + offset_usec) - (int64_t) awaited.present_usec;
+  cluster_swap_error = error_usec / (double) USEC_PER_SECOND;
+  if (coordinating) {
+    record_error(awaited.seq, error_usec);
+  } else if (coordinator_known) {
+    uint8_t buf[HEADER_SIZE + 12];
+    uint8_t *p = message(buf, MSG_REPORT);
+    put_u32(p, awaited.seq);
+    put_u64(p + 4, (uint64_t) error_usec);
+    send_to(&coordinator, buf, sizeof(buf));
+  }
+}
+
+// The poll timeout for the server thread, shortened for our next event.
+int cluster_timeout(int timeout_msec) {
+  if (!clustering)
+    return timeout_msec;
+  if (awaiting)
+    return SWAP_POLL_MSEC;
+
+  uint64_t now = gettime();
+  uint64_t next = now + (uint64_t) timeout_msec * 1000;
+  for (unsigned int i = 0; synced() && i < num_pending; i++)
+    if (due_usec(&pending[i]) < next)
+      next = due_usec(&pending[i]);
+  if (!coordinating && coordinator_known && next_sync_usec < next)
+    next = next_sync_usec;
+  return next > now ? (next - now + 999) / 1000 : 0;
+}
+
+/*
+ * Handle datagrams, if readable, and whatever is due: shows, reports and
+ * sync requests.  Called by the server thread after every poll.
+ */
+void cluster_handle(bool readable) {
+  if (!clustering)
+    return;
+
+  if (readable) {
+    uint8_t buf[MAX_DATAGRAM];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t n;
+    while ((n = recvfrom(cluster_sock, buf, sizeof(buf), 0, (struct sockaddr *) &from, &from_len)) >= 0) {
+      receive(buf, n, &from);
+      from_len = sizeof(from);
+    }
+  }
+
+  uint64_t now = gettime();
+
+  // did the drawing thread take the last panel shown?
+  if (awaiting) {
+    pthread_mutex_lock(&lock);
+    bool taken = (int32_t) (panels_taken - awaited_shown) >= 0;
+    uint64_t swap_usec = draw_panel_usec;
+    pthread_mutex_unlock(&lock);
+    if (taken)
+      swapped(swap_usec);
+    if (taken || now - awaited_since > SWAP_TIMEOUT_USEC)
+      awaiting = false;
+  }
+
+  // show what is due, in order; a show overtaken by the next is never drawn
+  while (synced() && num_pending > 0 && due_usec(&pending[0]) <= now) {
+    show_t show = pending[0];
+    memmove(pending, pending + 1, --num_pending * sizeof(show_t));
+    if (!panel_cache_show(show.id)) {
+      shows_missed++;
+      continue;
+    }
+    awaiting = true;
+    awaited = show;
+    pthread_mutex_lock(&lock);
+    awaited_shown = panels_shown;
+    pthread_mutex_unlock(&lock);
+    awaited_since = now;
+  }
+
+  if (!coordinating && coordinator_known && now >= next_sync_usec) {
+    uint8_t buf[HEADER_SIZE + 8];
+    put_u64(message(buf, MSG_SYNC), now);
+    send_to(&coordinator, buf, sizeof(buf));
+    next_sync_usec = now + (num_sync_samples < SYNC_SAMPLES ? FAST_SYNC_USEC : SYNC_USEC);
+  }
+}
+
+void cluster_close() {
+  if (!clustering)
+    return;
+
+  if (coordinating) {
+    for (unsigned int i = 0; i < NUM_SKEW_RECORDS; i++)
+      record_error(skews[i].seq + NUM_SKEW_RECORDS, 0);
+    if (skew_count)
+      printf("Cluster skew over %u panels: mean %.1f ms, max %.1f ms\n",
+          skew_count, skew_total / skew_count * 1000, skew_max * 1000);
+  } else {
+    printf("Cluster clock offset %.3f ms\n", cluster_clock_offset * 1000);
+  }
+  if (shows_missed)
+    printf("Cluster panels not shown: %u\n", shows_missed);
+
+  for (unsigned int i = 0; i < MAX_ASSEMBLIES; i++) {
+    free(assemblies[i].data);
+    free(assemblies[i].got);
+  }
+  close(cluster_sock);
+}
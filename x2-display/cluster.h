@@ -0,0 +1,47 @@
+#ifndef _cluster_h_
+#define _cluster_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+
+/*
+ * Several spheres showing the same panels at the same time.
+ *
+ * One x2-display is the coordinator (cluster = coordinator) and sends the
+ * panels its clients show to the nodes (cluster = node) over UDP, to the
+ * cluster_nodes addresses, which may be a multicast group the nodes join
+ * with cluster_group.  Panels travel once, into each node's panel cache,
+ * and are then shown by id at a time on the coordinator's clock,
+ * cluster_delay_ms after the coordinator received them.  Every sphere,
+ * the coordinator included, swaps the panel in at its rotation boundary
+ * nearest that time, on its own clock corrected by an offset it estimates
+ * from timestamped pings to the coordinator.  A node pings the
+ * cluster_coordinator address from startup, or wherever the first datagram
+ * came from, and holds shows until it has an offset.  The nodes report when
+ * they really swapped, and the coordinator reports how far apart the
+ * spheres were.
+ *
+ * Panels from clients of the coordinator are shown this way; effects,
+ * animations and panels sent straight to a node are not.  The cluster
+ * socket is handled on the server thread, which owns the panel cache.
+ */
+
+
+extern bool coordinating;
+extern double cluster_skew;          // between spheres for the last panel, seconds
+extern double cluster_clock_offset;  // coordinator clock less ours, seconds
+extern double cluster_swap_error;    // our last swap less its presentation time, seconds
+
+
+extern void cluster_init();
+extern int cluster_fd();
+extern int cluster_timeout(int timeout_msec);
+extern void cluster_handle(bool readable);
+extern bool cluster_present(const uint8_t *panel);
+extern bool cluster_present_cached(uint64_t id);
+extern void cluster_send_panel(uint64_t id, const uint8_t *data, uint32_t len);
+extern void cluster_close();
+
+
+#endif
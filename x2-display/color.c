@@ -0,0 +1,98 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "color.h"
+#include "config.h"
+
+
+#define DEFAULT_GAMMA 2.2
+#define COLOR_MAX (255 << COLOR_BITS)
+
+
+// externs
+uint16_t dither_thresholds[4][4];
+
+
+double gamma_exponent;
+double gains[3];  // white balance, red, green and blue
+
+// as with panels, the table the drawing thread is rendering the rotation
+// with, the latest one, which it takes at the next rotation, and a third
+// that is neither, rebuilt when the settings change
+color_lut_t luts[3];
+const color_lut_t *drawn_lut = &luts[0];    // protected by color_lock
+const color_lut_t *current_lut = &luts[0];  // protected by color_lock
+pthread_mutex_t color_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t color_set_lock = PTHREAD_MUTEX_INITIALIZER;  // one rebuild at a time
+
+
+// Bayer's 4x4 ordered dither matrix
+const uint8_t bayer[4][4] = {
+  { 0, 8, 2, 10 },
+  { 12, 4, 14, 6 },
+  { 3, 11, 1, 9 },
+  { 15, 7, 13, 5 },
+};
+
+
+uint16_t correct(unsigned int v, float contrast, float brightness, double gain) {
+  double x = v * contrast + brightness;
+  if (!(x > 0))  // also NaN
+    return 0;
+  if (x > 255)
+    x = 255;
+
+  double y = gain * COLOR_MAX * pow(x / 255, gamma_exponent);
+  return y < COLOR_MAX ? lround(y) : COLOR_MAX;
+}
+
+void color_set(float contrast, float brightness) {
+  pthread_mutex_lock(&color_set_lock);
+  pthread_mutex_lock(&color_lock);
+  color_lut_t *lut = &luts[0];
+  while (lut == drawn_lut || lut == current_lut)
+    lut++;
+  pthread_mutex_unlock(&color_lock);
+
+  for (unsigned int v = 0; v < 256; v++) {
+    lut->r[v] = correct(v, contrast, brightness, gains[0]);
+    lut->g[v] = correct(v, contrast, brightness, gains[1]);
+    lut->b[v] = correct(v, contrast, brightness, gains[2]);
+  }
+  lut->r[256] = lut->r[255];
+  lut->g[256] = lut->g[255];
+  lut->b[256] = lut->b[255];
+
+  pthread_mutex_lock(&color_lock);
+  current_lut = lut;
+  pthread_mutex_unlock(&color_lock);
+  pthread_mutex_unlock(&color_set_lock);
+}
+
+// Take the table to render the next rotation with; only the drawing thread
+// calls this, at the start of each rotation.
+const color_lut_t *color_lut() {
+  pthread_mutex_lock(&color_lock);
+  drawn_lut = current_lut;
+  pthread_mutex_unlock(&color_lock);
+  return drawn_lut;
+}
+
+void color_init() {
+  gamma_exponent = config_double("gamma", DEFAULT_GAMMA);
+  gains[0] = config_double("red_gain", 1);
+  gains[1] = config_double("green_gain", 1);
+  gains[2] = config_double("blue_gain", 1);
+  bool dither = config_int("dither", 1);
+  printf("Gamma %.2f, white balance %.2f %.2f %.2f%s\n", gamma_exponent, gains[0], gains[1], gains[2],
+      dither ? ", dithered" : "");
+
+  // without dithering, every value rounds to the nearest level
+  const unsigned int step = 1 << (COLOR_BITS - 4);
+  for (unsigned int i = 0; i < 4; i++)
+    for (unsigned int j = 0; j < 4; j++)
+      dither_thresholds[i][j] = dither ? bayer[i][j] * step + step / 2 : 1 << (COLOR_BITS - 1);
+
+  color_set(1, 0);
+}
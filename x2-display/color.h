@@ -0,0 +1,54 @@
+#ifndef _color_h_
+#define _color_h_
+
+#include <inttypes.h>
+
+
+/*
+ * Output colour correction: contrast, brightness, gamma and white balance
+ * folded into one 256-entry lookup table per channel, so that the render
+ * kernels do a table lookup per channel rather than float arithmetic, and
+ * values saturate rather than wrap.
+ *
+ * For each panel value v, out = gain * 255 * (clamp(v * contrast + brightness) / 255) ^ gamma.
+ *
+ * The tables keep COLOR_BITS bits below the 8 the LEDs take, which dark
+ * levels need after gamma.  With dithering on, they are rounded to 8 bits
+ * against a 4x4 ordered dither threshold that moves on every rotation, so
+ * each LED cycles through all 16 thresholds in 16 rotations and averages out
+ * to the finer level rather than a band.
+ */
+
+#define COLOR_BITS 8
+
+
+typedef struct {
+  // one extra entry, so that filtered values can interpolate up to 255
+  uint16_t r[257];
+  uint16_t g[257];
+  uint16_t b[257];
+} color_lut_t;
+
+
+extern uint16_t dither_thresholds[4][4];  // by slice position, then pixel
+
+
+// a table entry rounded to the LEDs' 8 bits
+static inline uint8_t color_round(uint32_t value, uint32_t threshold) {
+  return (value + threshold) >> COLOR_BITS;
+}
+
+// a table entry between v >> 8 and the next, for 8.8 fixed point v
+static inline uint32_t color_lerp(const uint16_t *table, uint32_t v) {
+  uint32_t i = v >> 8;
+  int32_t frac = v & 0xff;
+  return table[i] + (((table[i + 1] - table[i]) * frac) >> 8);
+}
+
+
+extern void color_init();
+extern const color_lut_t *color_lut();
+extern void color_set(float contrast, float brightness);
+
+
+#endif
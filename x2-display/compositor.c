@@ -0,0 +1,277 @@
+/*
+ * Overlay layers; see compositor.h.
+ *
+ * The server thread replaces and moves layers under layer_lock, marking the
+ * panel columns they covered and now cover as dirty.  The drawing thread
+ * takes the dirty columns under the same lock at the start of a rotation and
+ * recomposes just those in its composed panel: base pixels first, then each
+ * layer blended over them.  The lock is only held for pointer swaps and
+ * column marking on the server side, and for the composition itself on the
+ * drawing side, which is a handful of columns when a small layer moves.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compositor.h"
+#include "constants.h"
+#include "drawing.h"
+#include "err.h"
+#include "geometry.h"
+#include "metrics.h"
+#include "resample.h"
+
+
+typedef struct {
+  uint8_t *pixels;  // stride * height, NULL if the layer is unused
+  unsigned int stride;  // pixel columns, which scroll through the width shown
+  unsigned int width;   // panel columns covered
+  unsigned int height;
+  unsigned int x;   // panel column of the left edge
+  int y;            // panel row of the top edge, may be off the panel
+  double offset;    // pixel columns scrolled, 0 to stride
+  double speed;     // pixel columns per second
+} layer_t;
+
+
+pthread_mutex_t layer_lock = PTHREAD_MUTEX_INITIALIZER;
+layer_t layers[MAX_LAYERS];  // protected by layer_lock
+unsigned int layers_used = 0;  // protected by layer_lock, read without it by compose()
+uint8_t *dirty;  // columns to recompose, protected by layer_lock
+
+// the drawing thread's
+uint8_t *composed;
+const uint8_t *composed_base = NULL;  // base panel the composition is of, NULL if none
+uint8_t *redo;
+uint64_t last_compose_usec = 0;
+
+
+void compositor_init() {
+  if (posix_memalign((void **) &composed, CACHE_LINE_SIZE, geometry.panel_size) != 0)
+    error("ERROR allocating composed panel");
+  dirty = calloc(geometry.panel_width, 1);
+  redo = calloc(geometry.panel_width, 1);
+  if (dirty == NULL || redo == NULL)
+    error("ERROR allocating compositor");
+}
+
+unsigned int longitude_column(double longitude) {
+  double x = fmod(longitude / 360, 1) * geometry.panel_width;
+  return ((unsigned int) lround(x < 0 ? x + geometry.panel_width : x)) % geometry.panel_width;
+}
+
+// rows above or below the panel are clamped to just off it
+int latitude_row(double latitude) {
+  double y = (top_latitude - latitude) * geometry.panel_height / (top_latitude - bottom_latitude);
+  if (y < -(double) geometry.panel_height)
+    return -geometry.panel_height;
+  if (y > geometry.panel_height)
+    return geometry.panel_height;
+  return lround(y);
+}
+
+// call with layer_lock held
+void mark_dirty(const layer_t *l) {
+  if (l->pixels == NULL)
+    return;
+  unsigned int width = l->width < geometry.panel_width ? l->width : geometry.panel_width;
+  for (unsigned int i = 0; i < width; i++)
+    dirty[(l->x + i) % geometry.panel_width] = 1;
+}
+
+double columns_per_degree() {
+  return geometry.panel_width / 360.0;
+}
+
+/*
+ * Replace layer's pixels, stride columns by height rows, with the first
+ * width columns shown at longitude and latitude and scrolling at speed
+ * degrees per second, or remove the layer if pixels is NULL.  Takes the
+ * pixels, which must come from malloc().  Returns false, and frees them, if
+ * there is no such layer or it is taller or wider than a panel.
+ */
+bool layer_put(unsigned int layer, uint8_t *pixels, unsigned int stride, unsigned int width,
+    unsigned int height, double longitude, double latitude, double speed) {
+  if (layer >= MAX_LAYERS || width > geometry.panel_width || width > stride ||
+      height > geometry.panel_height || (pixels != NULL && (width == 0 || height == 0)) || !isfinite(longitude) || !isfinite(latitude) || !isfinite(speed)) {
+    free(pixels);
+    return false;
+  }
+
+  layer_t l = {
+    .pixels = pixels, .stride = stride, .width = width, .height = height,
+    .x = longitude_column(longitude), .y = latitude_row(latitude),
+    .offset = 0, .speed = speed * columns_per_degree(),
+  };
+
+  pthread_mutex_lock(&layer_lock);
+  uint8_t *old_pixels = layers[layer].pixels;
+  mark_dirty(&layers[layer]);
+  layers_used += (l.pixels != NULL) - (old_pixels != NULL);
+  layers[layer] = l;
+  mark_dirty(&layers[layer]);
+  pthread_mutex_unlock(&layer_lock);
+
+  free(old_pixels);
+  return true;
+}
+
+/*
+ * Copy width x height pixels into layer, as layer_put(), or remove it if
+ * width or height is 0.
+ */
+bool layer_set(unsigned int layer, double longitude, double latitude,
+    unsigned int width, unsigned int height, const uint8_t *pixels) {
+  if (width == 0 || height == 0)
+    return layer_put(layer, NULL, 0, 0, 0, longitude, latitude, 0);
+  if (width > geometry.panel_width || height > geometry.panel_height)
+    return false;
+
+  uint8_t *copy = malloc(width * height * PIXEL_SIZE);
+  if (copy == NULL)
+    return false;
+  memcpy(copy, pixels, width * height * PIXEL_SIZE);
+  return layer_put(layer, copy, width, width, height, longitude, latitude, 0);
+}
+
+// Move a layer.  Returns false if there is no such layer.
+bool layer_move(unsigned int layer, double longitude, double latitude) {
+  if (layer >= MAX_LAYERS || !isfinite(longitude) || !isfinite(latitude))
+    return false;
+
+  pthread_mutex_lock(&layer_lock);
+  layer_t *l = &layers[layer];
+  bool found = l->pixels != NULL;
+  if (found) {
+    mark_dirty(l);
+    l->x = longitude_column(longitude);
+    l->y = latitude_row(latitude);
+    mark_dirty(l);
+  }
+  pthread_mutex_unlock(&layer_lock);
+  return found;
+}
+
+/*
+ * Scroll a layer's pixels through the columns it covers at speed degrees per
+ * second, positive towards higher longitudes.  Returns false if there is no
+ * such layer.
+ */
+bool layer_scroll(unsigned int layer, double speed) {
+  if (layer >= MAX_LAYERS || !isfinite(speed))
+    return false;
+
+  pthread_mutex_lock(&layer_lock);
+  layer_t *l = &layers[layer];
+  bool found = l->pixels != NULL;
+  if (found)
+    l->speed = speed * columns_per_degree();
+  pthread_mutex_unlock(&layer_lock);
+  return found;
+}
+
+// call with layer_lock held
+void advance_scrolling(uint64_t now_usec) {
+  double seconds = last_compose_usec ? (now_usec - last_compose_usec) / (double) USEC_PER_SECOND : 0;
+  last_compose_usec = now_usec;
+
+  for (unsigned int i = 0; i < MAX_LAYERS; i++) {
+    layer_t *l = &layers[i];
+    if (l->pixels == NULL || l->speed == 0)
+      continue;
+    double offset = fmod(l->offset + l->speed * seconds, l->stride);
+    if (offset < 0)
+      offset += l->stride;
+    if ((unsigned int) offset != (unsigned int) l->offset)
+      mark_dirty(l);
+    l->offset = offset;
+  }
+}
+
+static inline uint8_t blend(unsigned int over, unsigned int under, unsigned int alpha) {
+  unsigned int v = over * alpha + under * (255 - alpha) + 128;
+  return (v + (v >> 8)) >> 8;  // v / 255, rounded
+}
+
+// call with layer_lock held
+void blend_layer(const layer_t *l) {
+  const unsigned int panel_width = geometry.panel_width;
+  for (unsigned int row = 0; row < l->height; row++) {
+    int y = l->y + (int) row;
+    if (y < 0 || y >= (int) geometry.panel_height)
+      continue;
+
+    const uint8_t *src_line = l->pixels + row * l->stride * PIXEL_SIZE;
+    uint8_t *line = composed + y * panel_width * PIXEL_SIZE;
+    unsigned int x = l->x;
+    unsigned int src_x = (l->stride - (unsigned int) l->offset) % l->stride;
+    for (unsigned int col = 0; col < l->width; col++) {
+      const uint8_t *src = src_line + src_x * PIXEL_SIZE;
+      if (++src_x == l->stride)
+        src_x = 0;
+      unsigned int alpha = src[0];
+      if (redo[x] && alpha != 0) {
+        uint8_t *dst = line + x * PIXEL_SIZE;
+        dst[1] = blend(src[1], dst[1], alpha);
+        dst[2] = blend(src[2], dst[2], alpha);
+        dst[3] = blend(src[3], dst[3], alpha);
+      }
+      if (++x == panel_width)
+        x = 0;
+    }
+  }
+}
+
+/*
+ * The panel to draw for base: base itself if there are no layers, or the
+ * layers composited over it, scrolled up to now_usec.  Only called by the
+ * drawing thread.
+ */
+const uint8_t *compose(const uint8_t *base, uint64_t now_usec) {
+  if (__atomic_load_n(&layers_used, __ATOMIC_RELAXED) == 0 && composed_base == NULL)
+    return base;
+
+  const unsigned int panel_width = geometry.panel_width;
+  pthread_mutex_lock(&layer_lock);
+  if (layers_used == 0) {
+    // the last layer went; recompose from scratch when one comes back
+    memset(dirty, 0, panel_width);
+    pthread_mutex_unlock(&layer_lock);
+    composed_base = NULL;
+    last_compose_usec = 0;
+    return base;
+  }
+  advance_scrolling(now_usec);
+
+  bool all = base != composed_base;
+  unsigned int num_redo = 0;
+  for (unsigned int x = 0; x < panel_width; x++) {
+    redo[x] = all || dirty[x];
+    num_redo += redo[x];
+  }
+  memset(dirty, 0, panel_width);
+
+  if (num_redo > 0) {
+    if (all) {
+      memcpy(composed, base, geometry.panel_size);
+    } else {
+      for (unsigned int y = 0; y < geometry.panel_height; y++) {
+        const uint32_t *src = (const uint32_t *) base + y * panel_width;
+        uint32_t *dst = (uint32_t *) composed + y * panel_width;
+        for (unsigned int x = 0; x < panel_width; x++)
+          if (redo[x])
+            dst[x] = src[x];
+      }
+    }
+    for (unsigned int i = 0; i < MAX_LAYERS; i++)
+      if (layers[i].pixels != NULL)
+        blend_layer(&layers[i]);
+    metrics_add(&metrics.columns_composited, num_redo);
+  }
+  pthread_mutex_unlock(&layer_lock);
+
+  composed_base = base;
+  return composed;
+}
@@ -0,0 +1,39 @@
+#ifndef _compositor_h_
+#define _compositor_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+
+/*
+ * Overlay layers composited over the panel being shown, so that small
+ * elements such as a clock can be sent once and moved cheaply instead of
+ * re-sending whole panels.
+ *
+ * Each layer is a rectangle of panel pixels whose first byte, unused in
+ * panels, is its alpha (0 transparent to 255 opaque), placed with its top
+ * left corner at a longitude and latitude and wrapping around the sphere.
+ * Its pixels may be wider than the columns it covers, and scroll through
+ * them at a constant angular speed, so a marquee is rasterized once and
+ * then only recomposed as it moves.  Layers are drawn in index order over
+ * the base panel.
+ *
+ * The drawing thread composites at the start of each rotation into a panel
+ * of its own, and only recomposes the columns that layer changes and
+ * scrolling touched, unless the base panel itself changed.
+ */
+
+#define MAX_LAYERS 8
+
+
+extern void compositor_init();
+extern bool layer_put(unsigned int layer, uint8_t *pixels, unsigned int stride, unsigned int width,
+    unsigned int height, double longitude, double latitude, double speed);
+extern bool layer_set(unsigned int layer, double longitude, double latitude,
+    unsigned int width, unsigned int height, const uint8_t *pixels);
+extern bool layer_move(unsigned int layer, double longitude, double latitude);
+extern bool layer_scroll(unsigned int layer, double speed);
+extern const uint8_t *compose(const uint8_t *base, uint64_t now_usec);
+
+
+#endif
@@ -0,0 +1,101 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+
+
+#define MAX_CONFIG_ENTRIES 128
+#define MAX_LINE 512
+
+
+typedef struct {
+  char *key;
+  char *value;
+} config_entry_t;
+
+
+config_entry_t config_entries[MAX_CONFIG_ENTRIES];
+int num_config_entries = 0;
+
+
+char *trim(char *s) {
+  while (isspace((unsigned char) *s))
+    s++;
+  char *end = s + strlen(s);
+  while (end > s && isspace((unsigned char) end[-1]))
+    end--;
+  *end = '\0';
+  return s;
+}
+
+/*
+ * Read a config file.  Returns false if it cannot be opened; malformed lines
+ * are reported and skipped.  Later files and later lines override earlier ones.
+ */
+bool config_load(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return false;
+
+  char line[MAX_LINE];
+  int line_num = 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    line_num++;
+
+    char *comment = strchr(line, '#');
+    if (comment != NULL)
+      *comment = '\0';
+
+    char *s = trim(line);
+    if (*s == '\0')
+      continue;
+
+    char *eq = strchr(s, '=');
+    if (eq == NULL) {
+      fprintf(stderr, "%s:%d: expected key = value\n", path, line_num);
+      continue;
+    }
+    *eq = '\0';
+    char *key = trim(s);
+    char *value = trim(eq + 1);
+
+    int i;
+    for (i = 0; i < num_config_entries; i++)
+      if (strcmp(config_entries[i].key, key) == 0)
+        break;
+    if (i == num_config_entries) {
+      if (num_config_entries == MAX_CONFIG_ENTRIES) {
+        fprintf(stderr, "%s:%d: too many settings\n", path, line_num);
+        continue;
+      }
+      config_entries[i].key = strdup(key);
+      num_config_entries++;
+    } else {
+      free(config_entries[i].value);
+    }
+    config_entries[i].value = strdup(value);
+  }
+
+  fclose(f);
+  printf("Read configuration from %s\n", path);
+  return true;
+}
+
+const char *config_string(const char *key, const char *default_value) {
+  for (int i = 0; i < num_config_entries; i++)
+    if (strcmp(config_entries[i].key, key) == 0)
+      return config_entries[i].value;
+  return default_value;
+}
+
+int config_int(const char *key, int default_value) {
+  const char *value = config_string(key, NULL);
+  return value ? atoi(value) : default_value;
+}
+
+double config_double(const char *key, double default_value) {
+  const char *value = config_string(key, NULL);
+  return value ? atof(value) : default_value;
+}
@@ -0,0 +1,22 @@
+#ifndef _config_h_
+#define _config_h_
+
+#include <stdbool.h>
+
+
+/*
+ * Startup configuration, read from a file of "key = value" lines.
+ * Blank lines and anything after a '#' are ignored.  Each module looks up
+ * its own keys, falling back to its compiled-in default when a key is absent.
+ */
+
+#define DEFAULT_CONFIG_PATH "x2-display.conf"
+
+
+extern bool config_load(const char *path);
+extern const char *config_string(const char *key, const char *default_value);
+extern int config_int(const char *key, int default_value);
+extern double config_double(const char *key, double default_value);
+
+
+#endif
@@ -3,6 +3,9 @@
 
 
 #define USEC_PER_SECOND 1000000
+#define NSEC_PER_SECOND 1000000000ULL
+
+#define CACHE_LINE_SIZE 64
 
 
 #endif
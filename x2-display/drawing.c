@@ -1,30 +1,142 @@
 #include <inttypes.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "calibration.h"
+#include "capture.h"
+#include "color.h"
+#include "compositor.h"
+#include "config.h"
+#include "constants.h"
 #include "debug.h"
 #include "drawing.h"
+#include "err.h"
+#include "geometry.h"
+#include "metrics.h"
+#include "power.h"
+#include "render.h"
+#include "slice-filter.h"
 #include "strip-map.h"
 #include "timing.h"
+#include "trace.h"
 #include "x2-server.h"
 
 
+#define MAX_DISPLAY_INTERVAL_USEC (USEC_PER_SECOND / 10)
+#define DEFAULT_SLICE_HEADROOM 1.2
+#define DEFAULT_MAX_SPIN 360  // degrees per second
+
+
 // externs
-char panels[3][PANEL_SIZE];
-int draw_idx = 0;
-int to_draw_idx = 0;
-int fill_idx;
+ledscape_t *leds;
+uint8_t *panels[3];
+const uint8_t *draw_panel;
+const uint8_t *to_draw_panel;
+uint32_t panels_shown = 0;
+uint32_t panels_taken = 0;
+uint64_t draw_panel_usec = 0;
 double fps = 0.0;
+unsigned int slices_per_rotation;
+uint64_t slice_usec = 0;
 
 
-ledscape_t * leds;
-uint32_t x_offset = 0;
+uint32_t x_offset = 0;  // whole columns of x_position
+unsigned int x_phase = 0;  // and the fraction, in 1 / 2^FILTER_BITS columns
 float brightness = 0;
 float contrast = 1;
 
+bool adaptive_slices;
+unsigned int max_slices;
+double slice_headroom;
+
+// spinning, protected by lock
+double x_position = 0;  // panel columns
+double x_velocity = 0;  // columns per second
+double x_acceleration = 0;  // columns per second per second
+double max_velocity;
+uint64_t last_spin_usec = 0;
+
 
 void drawing_init() {
-  leds = ledscape_init(NUM_PIXELS_PER_STRIP);
+  for (int i = 0; i < 3; i++) {
+    if (posix_memalign((void **) &panels[i], CACHE_LINE_SIZE, geometry.panel_size) != 0)
+      error("ERROR allocating panels");
+    memset(panels[i], 0, geometry.panel_size);
+  }
+  draw_panel = to_draw_panel = panels[0];
+
+  // angular resolution, fixed at the panel width unless adaptive
+  slices_per_rotation = geometry.num_slices;
+  adaptive_slices = config_int("adaptive_slices", 1);
+  max_slices = config_int("max_slices", 2 * geometry.num_slices);
+  max_slices -= max_slices % geometry.num_arms;
+  if (max_slices < geometry.num_arms)
+    max_slices = geometry.num_arms;
+  slice_headroom = config_double("slice_headroom", DEFAULT_SLICE_HEADROOM);
+  max_velocity = config_double("max_spin", DEFAULT_MAX_SPIN) * geometry.panel_width / 360;
+
+  color_init();
+  calibration_init();
+  power_init();
+  slice_filter_init();
+  compositor_init();
+  render_init();
+  leds = ledscape_init(geometry.pixels_per_strip);
+
+  // consume the startup acknowledgement, so that every later draw is
+  // matched by exactly one wait
+  ledscape_wait(leds);
+}
+
+/*
+ * Pick the number of slices for the next rotation: as many as fit in the
+ * measured rotation period given what a slice really costs, rounded down to
+ * a multiple of the arm count so that the arms stay on slice boundaries.
+ * Resolution drops immediately when the sphere speeds up, so that slices are
+ * not dropped, but only rises again once it is worth at least 5%.
+ */
+unsigned int choose_num_slices(uint64_t period_usec) {
+  if (!adaptive_slices || slice_usec == 0)
+    return slices_per_rotation;
+
+  uint64_t budget_usec = slice_usec * slice_headroom;
+  unsigned int n = period_usec / (budget_usec ? budget_usec : 1);
+  n -= n % geometry.num_arms;
+  if (n < geometry.num_arms)
+    n = geometry.num_arms;
+  if (n > max_slices)
+    n = max_slices;
+
+  if (n > slices_per_rotation && n * 20 < slices_per_rotation * 21)
+    return slices_per_rotation;
+  return n;
+}
+
+/*
+ * Integrate the spin up to now, for the rotation starting, and take the x
+ * offset to draw it at.  Call with lock held.
+ */
+void advance_spin(uint64_t now_usec) {
+  double seconds = last_spin_usec ? (now_usec - last_spin_usec) / (double) USEC_PER_SECOND : 0;
+  last_spin_usec = now_usec;
+  if (x_velocity == 0 && x_acceleration == 0)
+    return;
+
+  double velocity = x_velocity + x_acceleration * seconds;
+  if (velocity > max_velocity)
+    velocity = max_velocity;
+  if (velocity < -max_velocity)
+    velocity = -max_velocity;
+  x_position = fmod(x_position + (x_velocity + velocity) / 2 * seconds, geometry.panel_width);
+  if (x_position < 0)
+    x_position += geometry.panel_width;
+  x_velocity = velocity;
+
+  unsigned int position = lround(x_position * (1 << FILTER_BITS));
+  x_offset = (position >> FILTER_BITS) % geometry.panel_width;
+  x_phase = position & ((1 << FILTER_BITS) - 1);
 }
 
 void *drawing_func() {
@@ -33,18 +145,55 @@ void *drawing_func() {
   time_t last_sec = time(NULL);
   unsigned int last_i = 0;
   unsigned int i = 0;
+  unsigned int slices_drawn = 0;  // last rotation
 
   while (keepalive) {
     i++;
 
-    // set draw index from to-draw index
+    // set draw panel from to-draw panel
     pthread_mutex_lock(&lock);
-    draw_idx = to_draw_idx;
+    if (draw_panel != to_draw_panel)
+      trace_event(TRACE_DRAWING, TRACE_PANEL_SWAP, 0, 0);
+    if (panels_taken != panels_shown) {
+      // taken even if it is the panel already being drawn
+      panels_taken = panels_shown;
+      draw_panel_usec = gettime();
+    }
+    draw_panel = to_draw_panel;
+    bool rewired = strip_map_update();
+    advance_spin(gettime());
     pthread_mutex_unlock(&lock);
 
+    // lanes that fell out of use would otherwise keep their last pixels
+    if (rewired)
+      for (int f = 0; f < 2; f++)
+        memset(ledscape_frame(leds, f), 0, geometry.frame_size);
+
     new_frame = false;
     uint64_t start_usec = gettime();
-    for (unsigned int slice_idx = 0; slice_idx < NUM_SLICES; slice_idx++) {
+
+    // overlay layers, recomposed where they changed
+    const uint8_t *panel = compose(draw_panel, start_usec);
+
+    // choose the angular resolution for this rotation
+    unsigned int num_slices = choose_num_slices(rotation_usec);
+    slices_per_rotation = num_slices;
+    uint64_t display_interval_usec = rotation_usec / num_slices;
+    if (display_interval_usec > MAX_DISPLAY_INTERVAL_USEC)
+      display_interval_usec = MAX_DISPLAY_INTERVAL_USEC;
+    const slice_taps_t *filter = slice_filter(num_slices, x_phase);
+    const color_lut_t *lut = color_lut();
+    const led_calibration_t *cal = calibration();
+    power_rotation(slices_drawn);
+
+    // render the first slice; each later one is rendered while the previous
+    // one is being clocked out
+    frame_num = (frame_num + 1) % 2;
+    render_slice(ledscape_frame(leds, frame_num), panel, 0, num_slices, x_offset, i, lut, cal, filter);
+    power_limit(ledscape_frame(leds, frame_num));
+
+    unsigned int slice_idx;
+    for (slice_idx = 0; slice_idx < num_slices; slice_idx++) {
       if (new_frame || !keepalive) {
         break;
       }
@@ -54,35 +203,38 @@ void *drawing_func() {
       printf("%d now %" PRIu64 ", end %" PRIu64 ", diff %" PRIu64 "\n", slice_idx, start_usec, end_time_usec, end_time_usec - start_usec);
 #endif
 
-      // alternate frame buffers on each draw command
-      frame_num = (frame_num + 1) % 2;
+      // draw frame
       ledscape_frame_t * const frame = ledscape_frame(leds, frame_num);
+      uint64_t draw_usec = gettime();
+      uint64_t scheduled_usec = start_usec + slice_idx * display_interval_usec;
+      trace_event(TRACE_DRAWING, TRACE_SLICE_START, slice_idx,
+          draw_usec > scheduled_usec ? (draw_usec - scheduled_usec) * 1000 : 0);
+      ledscape_draw(leds, frame_num);
+      trace_event(TRACE_DRAWING, TRACE_PRU_SUBMIT, slice_idx, 0);
 
-      // copy panel.frame -> frame
-      for (int strip_idx = 0; strip_idx < LEDSCAPE_NUM_STRIPS; strip_idx++) {
-        unsigned int row = strip_idx / 4;  // range: 0-6
-        unsigned int col = (4 - strip_idx) % 4;  // range: 0-3
-
-        unsigned int y_offset = row * NUM_PIXELS_PER_STRIP;
-        for (unsigned int pixel_idx = 0; pixel_idx < NUM_PIXELS_PER_STRIP; pixel_idx++) {
-          // get RGB data from panel
-          unsigned int y = y_offset + (row < 3 ? pixel_idx : NUM_PIXELS_PER_STRIP - 1 - pixel_idx);  // invert pixel_idx for lower hemisphere
-          unsigned int x = (NUM_SLICES - 1 - (x_offset + slice_idx + (col * QUADRANT_WIDTH))) % NUM_SLICES;
-          uint8_t r = panels[draw_idx][(((y * NUM_SLICES) + x) * PIXEL_SIZE) + 1];
-          uint8_t g = panels[draw_idx][(((y * NUM_SLICES) + x) * PIXEL_SIZE) + 2];
-          uint8_t b = panels[draw_idx][(((y * NUM_SLICES) + x) * PIXEL_SIZE) + 3];
-
-          r = (r * contrast) + brightness;
-          g = (g * contrast) + brightness;
-          b = (b * contrast) + brightness;
-
-          ledscape_set_color(frame, strip_map[strip_idx], pixel_idx, r, g, b);
-        }
+      // alternate frame buffers on each draw command
+      frame_num = (frame_num + 1) % 2;
+      if (slice_idx + 1 < num_slices) {
+        render_slice(ledscape_frame(leds, frame_num), panel, slice_idx + 1, num_slices, x_offset, i, lut, cal, filter);
+        power_limit(ledscape_frame(leds, frame_num));
+        trace_event(TRACE_DRAWING, TRACE_RENDER_DONE, slice_idx + 1, 0);
       }
 
-      // draw frame
+      // wait for the transfer; this also times what a slice really costs,
+      // the longer of rendering and clocking out
       ledscape_wait(leds);
-      ledscape_draw(leds, frame_num);
+      uint64_t done_usec = gettime();
+      metrics_add(&metrics.slices_drawn, 1);
+      trace_event(TRACE_DRAWING, TRACE_PRU_DONE, slice_idx, 0);
+      if (done_usec > end_time_usec) {
+        metrics_add(&metrics.deadline_misses, 1);
+        trace_event(TRACE_DRAWING, TRACE_DEADLINE_MISS, slice_idx, (done_usec - end_time_usec) * 1000);
+      }
+      uint64_t cost_usec = done_usec - draw_usec;
+      slice_usec = slice_usec ? (7 * slice_usec + cost_usec) / 8 : cost_usec;
+
+      if (capturing)
+        capture_frame(frame, i, slice_idx, num_slices, draw_usec);
 
       // wait until end of frame
       uint64_t now_usec = gettime();
@@ -91,6 +243,16 @@ void *drawing_func() {
       }
     }
 
+    slices_drawn = slice_idx;
+    if (keepalive && slice_idx < num_slices)
+      metrics_add(&metrics.slices_dropped, num_slices - slice_idx);
+
+    // every slice is out: hold the last one until the hall sensor starts the
+    // next rotation, rather than starting one out of step with it
+    uint64_t timeout_usec = start_usec + 2 * rotation_usec;
+    while (!new_frame && keepalive && gettime() < timeout_usec)
+      ;
+
     // track (panel) frames per second
     time_t now_sec = time(NULL);
     if (now_sec != last_sec) {
@@ -103,10 +265,10 @@ void *drawing_func() {
   // blank all strips
   ledscape_frame_t * const frame = ledscape_frame(leds, frame_num);
   for (unsigned int strip_idx = 0; strip_idx < LEDSCAPE_NUM_STRIPS; strip_idx++)
-    for (unsigned int pixel_idx = 0; pixel_idx < NUM_PIXELS_PER_STRIP; pixel_idx++)
+    for (unsigned int pixel_idx = 0; pixel_idx < geometry.pixels_per_strip; pixel_idx++)
       ledscape_set_color(frame, strip_idx, pixel_idx, 0, 0, 0);
-  ledscape_wait(leds);
   ledscape_draw(leds, frame_num);
+  ledscape_wait(leds);
 
   ledscape_close(leds);
 
@@ -114,16 +276,68 @@ void *drawing_func() {
   return NULL;
 }
 
+/*
+ * Pick one of three buffers that is neither being drawn nor waiting to be
+ * drawn, to fill with the next panel.  Each set of buffers must only be
+ * filled by one thread.
+ */
+uint8_t *unused_panel(uint8_t * const *buffers) {
+  pthread_mutex_lock(&lock);
+  int fill_idx = 0;
+  while (buffers[fill_idx] == draw_panel || buffers[fill_idx] == to_draw_panel)
+    fill_idx++;
+  pthread_mutex_unlock(&lock);
+  return buffers[fill_idx];
+}
+
+// a panel buffer for the server to fill
+uint8_t *fill_panel() {
+  return unused_panel(panels);
+}
+
+// draw panel from the next rotation on
+void show_panel(const uint8_t *panel) {
+  pthread_mutex_lock(&lock);
+  to_draw_panel = panel;
+  panels_shown++;
+  pthread_mutex_unlock(&lock);
+}
+
 uint32_t set_x_offset(uint32_t value) {
+  pthread_mutex_lock(&lock);
+  x_position = value % geometry.panel_width;
   x_offset = value;
+  x_phase = 0;
+  pthread_mutex_unlock(&lock);
 #if DEBUG_DRAW_SETTINGS
   printf("x offset: %d\n", x_offset);
 #endif
   return x_offset;
 }
 
+/*
+ * Spin the panel around the axis at velocity degrees per second, changing by
+ * acceleration degrees per second every second, up to max_spin either way,
+ * from the next rotation on.  Positive velocities increase the x offset.
+ */
+void set_spin(float *velocity, float *acceleration) {
+  const double columns_per_degree = geometry.panel_width / 360.0;
+  pthread_mutex_lock(&lock);
+  if (isfinite(*velocity))
+    x_velocity = fmax(-max_velocity, fmin(max_velocity, *velocity * columns_per_degree));
+  if (isfinite(*acceleration))
+    x_acceleration = *acceleration * columns_per_degree;
+  *velocity = x_velocity / columns_per_degree;
+  *acceleration = x_acceleration / columns_per_degree;
+  pthread_mutex_unlock(&lock);
+#if DEBUG_DRAW_SETTINGS
+  printf("spin: %f, %f\n", *velocity, *acceleration);
+#endif
+}
+
 float set_brightness(float value) {
   brightness = value;
+  color_set(contrast, brightness);
 #if DEBUG_DRAW_SETTINGS
   printf("brightness: %f\n", brightness);
 #endif
@@ -132,6 +346,7 @@ float set_brightness(float value) {
 
 float set_contrast(float value) {
   contrast = value;
+  color_set(contrast, brightness);
 #if DEBUG_DRAW_SETTINGS
   printf("contrast: %f\n", contrast);
 #endif
@@ -1,35 +1,42 @@
 #ifndef _drawing_h_
 #define _drawing_h_
 
+#include <inttypes.h>
 #include "ledscape.h"
 
 
 /*
- * 3 panels, one of which is being drawn in, is to be drawn in, and is being filled
- * each panel consists of 224 slices, where each slice is a horizontal line of resolution
- * a frame consists of the rgb values for each of the 17 pixels in all of the 24 led strips
+ * 3 panels, one of which is being drawn in, is to be drawn in, and is being filled;
+ * the panels being drawn and to be drawn may also be cached panels, which are
+ * shown by swapping pointers rather than copying
+ * each panel consists of geometry.num_slices slices, where each slice is a vertical line of resolution
+ * a frame consists of the rgb values for each of the pixels in all of the led strips
  * each pixel takes up 4 bytes of information, stored as BRGA (but A is not used)
- * each frame encompasses 4 slices
+ * each frame encompasses one slice per arm
  */
 
-#define NUM_PIXELS_PER_STRIP 17
 #define PIXEL_SIZE 4
-#define FRAME_SIZE (LEDSCAPE_NUM_STRIPS * NUM_PIXELS_PER_STRIP * PIXEL_SIZE)
-#define QUADRANT_WIDTH 56
-#define NUM_SLICES (QUADRANT_WIDTH * 4)
-#define PANEL_SIZE (QUADRANT_WIDTH * FRAME_SIZE)
 
 
-extern char panels[3][PANEL_SIZE];
-extern int draw_idx;
-extern int to_draw_idx;
-extern int fill_idx;
+extern ledscape_t *leds;
+extern uint8_t *panels[3];
+extern const uint8_t *draw_panel;     // being drawn, protected by lock
+extern const uint8_t *to_draw_panel;  // drawn from the next rotation, protected by lock
+extern uint32_t panels_shown;     // show_panel() calls, protected by lock
+extern uint32_t panels_taken;     // panels_shown when the drawing thread last took one, protected by lock
+extern uint64_t draw_panel_usec;  // when it did, protected by lock
 extern double fps;  // frames per second
+extern unsigned int slices_per_rotation;  // current angular resolution
+extern uint64_t slice_usec;  // measured time to render and clock out a slice
 
 
 extern void drawing_init();
 extern void *drawing_func();
+extern uint8_t *unused_panel(uint8_t * const *buffers);
+extern uint8_t *fill_panel();
+extern void show_panel(const uint8_t *panel);
 extern uint32_t set_x_offset(uint32_t value);
+extern void set_spin(float *velocity, float *acceleration);
 extern float set_brightness(float value);
 extern float set_contrast(float value);
 
@@ -0,0 +1,348 @@
+/*
+ * Effect kernels and the effect thread; see effects.h.
+ *
+ * The kernels keep transcendental functions out of the per-pixel work: the
+ * plasma sums a fixed point sine table and maps the sum through a palette,
+ * the starfield only touches its stars, and the globe uses per-row and
+ * per-column sines and cosines, so each pixel is a few multiplies and one
+ * word store.
+ */
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "constants.h"
+#include "drawing.h"
+#include "effects.h"
+#include "err.h"
+#include "geometry.h"
+#include "x2-server.h"
+
+
+#define DEFAULT_EFFECT_FPS 60
+#define MAX_THREADS 8
+#define IDLE_SLEEP_NSEC (50 * 1000 * 1000)
+#define SINE_STEPS 1024  // a whole turn
+#define MAX_STARS 4096
+#define MIN_PLASMA_SCALE 0.125  // a row step of one sine table step
+#define MAX_PLASMA_SCALE 32     // whole waves in 16.16 column steps
+#define MAX_PLASMA_SPEED 100
+#define MAX_STARS_SPEED 10      // turns per second
+
+
+// plasma, params: speed, scale
+void plasma(uint8_t *panel, unsigned int row_begin, unsigned int row_end, double t, const float *params);
+// starfield drifting around the axis, params: number of stars, speed in turns per second
+void stars(uint8_t *panel, unsigned int row_begin, unsigned int row_end, double t, const float *params);
+// globe on a tilted axis, params: tilt in degrees, turns per second
+void globe(uint8_t *panel, unsigned int row_begin, unsigned int row_end, double t, const float *params);
+
+const effect_t effects[] = {
+  { "plasma", plasma },
+  { "stars", stars },
+  { "globe", globe },
+};
+
+
+unsigned int effect_fps;
+unsigned int num_bands;
+uint8_t *effect_panels[3];
+
+// the effect running, protected by effect_lock
+pthread_mutex_t effect_lock = PTHREAD_MUTEX_INITIALIZER;
+const effect_t *current_effect = NULL;
+float current_params[EFFECT_MAX_PARAMS];
+bool restarted = false;  // start the effect's clock again
+
+// the frame being rendered, for the band threads
+pthread_barrier_t frame_start;
+pthread_barrier_t frame_done;
+const effect_t *band_effect;
+uint8_t *band_panel;
+double band_time;
+float band_params[EFFECT_MAX_PARAMS];
+bool stopping = false;
+
+int16_t sine[SINE_STEPS];  // sin * 2^14
+float *row_sin, *row_cos, *col_sin, *col_cos;
+
+
+// one word store per pixel; panels are aligned and the ARM is little-endian
+static inline void put_rgb(uint8_t *p, uint32_t r, uint32_t g, uint32_t b) {
+  *(uint32_t *) p = r << 8 | g << 16 | b << 24;
+}
+
+static inline float param(const float *params, unsigned int i, float default_value) {
+  return params[i] != 0 ? params[i] : default_value;
+}
+
+// a parameter clamped to the range the kernel's arithmetic allows
+static inline float bounded_param(const float *params, unsigned int i, float default_value, float min, float max) {
+  float value = param(params, i, default_value);
+  if (!isfinite(value))
+    return default_value;
+  return value < min ? min : value > max ? max : value;
+}
+
+// an angle in sine table steps, of either sign, as an index into the table
+static inline unsigned int sine_index(double steps) {
+  double i = fmod(steps, SINE_STEPS);
+  return (unsigned int) (i < 0 ? i + SINE_STEPS : i) % SINE_STEPS;
+}
+
+static inline unsigned int palette(unsigned int i) {
+  return 128 + (sine[i % SINE_STEPS] * 127 >> 14);
+}
+
+void plasma(uint8_t *panel, unsigned int row_begin, unsigned int row_end, double t, const float *params) {
+  const unsigned int width = geometry.panel_width;
+  const float speed = bounded_param(params, 0, 1, -MAX_PLASMA_SPEED, MAX_PLASMA_SPEED);
+  const float scale = bounded_param(params, 1, 1, MIN_PLASMA_SCALE, MAX_PLASMA_SCALE);
+
+  // phases in sine table steps
+  const unsigned int phase1 = sine_index(t * speed * 97);
+  const unsigned int phase2 = sine_index(t * speed * 131);
+  const unsigned int phase3 = sine_index(t * speed * 61);
+  // whole waves around the sphere, so that the columns wrap seamlessly; 16.16 steps
+  const unsigned int waves = scale < 1 ? 1 : (unsigned int) scale;
+  const unsigned int col_step = (SINE_STEPS * waves << 16) / width;
+  const unsigned int row_step = 8 * scale;
+
+  for (unsigned int y = row_begin; y < row_end; y++) {
+    uint8_t *p = panel + y * width * PIXEL_SIZE;
+    int row_term = sine[(y * row_step + phase2) % SINE_STEPS];
+    for (unsigned int x = 0; x < width; x++, p += PIXEL_SIZE) {
+      int v = sine[((x * col_step * 2 >> 16) + phase1) % SINE_STEPS] + row_term +
+          sine[((x * col_step >> 16) + y * row_step + phase3) % SINE_STEPS];
+      // -3 to 3 (times 2^14) once around the palette, itself a sine
+      unsigned int i = (unsigned int) (v + 3 * 16384) * (SINE_STEPS - 1) / (6 * 16384);
+      put_rgb(p, palette(i), palette(i + SINE_STEPS / 3), palette(i + 2 * SINE_STEPS / 3));
+    }
+  }
+}
+
+// a reproducible pseudo-random number for star i
+static inline uint32_t hash(uint32_t i) {
+  i ^= i >> 16;
+  i *= 0x7feb352d;
+  i ^= i >> 15;
+  i *= 0x846ca68b;
+  i ^= i >> 16;
+  return i;
+}
+
+void stars(uint8_t *panel, unsigned int row_begin, unsigned int row_end, double t, const float *params) {
+  const unsigned int width = geometry.panel_width;
+  const unsigned int num_stars = bounded_param(params, 0, 200, 0, MAX_STARS);
+  const float speed = bounded_param(params, 1, 0.1, -MAX_STARS_SPEED, MAX_STARS_SPEED);
+
+  memset(panel + row_begin * width * PIXEL_SIZE, 0, (row_end - row_begin) * width * PIXEL_SIZE);
+  for (unsigned int i = 0; i < num_stars; i++) {
+    uint32_t h = hash(i);
+    unsigned int y = h % geometry.panel_height;
+    if (y < row_begin || y >= row_end)
+      continue;
+
+    // nearer stars move faster and shine brighter, and all of them twinkle
+    float depth = 0.25 + (h >> 24) / 340.0;
+    double x = fmod((hash(i + 0x10000) % width) + t * speed * depth * width, width);
+    if (x < 0)
+      x += width;
+    unsigned int column = (unsigned int) x % width;
+    unsigned int level = 255 * depth * (0.75 + 0.25 * sine[sine_index(t * 300 + h)] / 16384);
+    put_rgb(panel + (y * width + column) * PIXEL_SIZE, level, level, level * 7 / 8 + 32);
+  }
+}
+
+void globe(uint8_t *panel, unsigned int row_begin, unsigned int row_end, double t, const float *params) {
+  const unsigned int width = geometry.panel_width;
+  const float tilt = param(params, 0, 23.5) * M_PI / 180;
+  const float spin = t * param(params, 1, 0.1) * 2 * M_PI;
+  const float st = sinf(tilt), ct = cosf(tilt);
+  const float ss = sinf(spin), cs = cosf(spin);
+
+  for (unsigned int y = row_begin; y < row_end; y++) {
+    uint8_t *p = panel + y * width * PIXEL_SIZE;
+    for (unsigned int x = 0; x < width; x++, p += PIXEL_SIZE) {
+      // the pixel's direction, tilted into the globe's frame, then spun
+      float vx = row_cos[y] * col_cos[x];
+      float vy = row_cos[y] * col_sin[x];
+      float vz = row_sin[y];
+      float gy = vy * ct - vz * st;
+      float gz = vy * st + vz * ct;
+      float gx = vx * cs + gy * ss;
+      gy = gy * cs - vx * ss;
+
+      // 30 degree squares of land and sea, with ice caps
+      unsigned int lat_band = (gz + 1) * 3;
+      unsigned int lon_band = (gx > 0 ? 0 : 2) + (gy > 0 ? 0 : 1) + (fabsf(gx) > fabsf(gy) ? 4 : 0);
+      if (gz > 0.9 || gz < -0.9)
+        put_rgb(p, 220, 230, 240);
+      else if ((lat_band + lon_band) % 3 == 0)
+        put_rgb(p, 40, 140, 40);
+      else
+        put_rgb(p, 10, 40, 160);
+    }
+  }
+}
+
+
+// render the band of rows for thread i
+void render_band(unsigned int i) {
+  unsigned int begin = geometry.panel_height * i / num_bands;
+  unsigned int end = geometry.panel_height * (i + 1) / num_bands;
+  band_effect->render(band_panel, begin, end, band_time, band_params);
+}
+
+void *band_func(void *arg) {
+  unsigned int i = (uintptr_t) arg;
+  while (true) {
+    pthread_barrier_wait(&frame_start);
+    if (stopping)
+      return NULL;
+    render_band(i);
+    pthread_barrier_wait(&frame_done);
+  }
+}
+
+void effects_init() {
+  effect_fps = config_int("effect_fps", DEFAULT_EFFECT_FPS);
+  if (effect_fps < 1)
+    effect_fps = 1;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  num_bands = config_int("effect_threads", cpus > 0 ? cpus : 1);
+  if (num_bands < 1)
+    num_bands = 1;
+  if (num_bands > MAX_THREADS)
+    num_bands = MAX_THREADS;
+
+  for (int i = 0; i < 3; i++) {
+    if (posix_memalign((void **) &effect_panels[i], CACHE_LINE_SIZE, geometry.panel_size) != 0)
+      error("ERROR allocating effect panels");
+  }
+
+  for (unsigned int i = 0; i < SINE_STEPS; i++)
+    sine[i] = lround(16384 * sin(2 * M_PI * i / SINE_STEPS));
+
+  // pixel centres: north at the top, longitude 0 at the left
+  row_sin = malloc(geometry.panel_height * sizeof(float));
+  row_cos = malloc(geometry.panel_height * sizeof(float));
+  col_sin = malloc(geometry.panel_width * sizeof(float));
+  col_cos = malloc(geometry.panel_width * sizeof(float));
+  if (row_sin == NULL || row_cos == NULL || col_sin == NULL || col_cos == NULL)
+    error("ERROR allocating effect tables");
+  for (unsigned int y = 0; y < geometry.panel_height; y++) {
+    double lat = M_PI / 2 - M_PI * (y + 0.5) / geometry.panel_height;
+    row_sin[y] = sin(lat);
+    row_cos[y] = cos(lat);
+  }
+  for (unsigned int x = 0; x < geometry.panel_width; x++) {
+    double lon = 2 * M_PI * (x + 0.5) / geometry.panel_width;
+    col_sin[x] = sin(lon);
+    col_cos[x] = cos(lon);
+  }
+
+  const char *name = config_string("effect", NULL);
+  if (name != NULL && !effect_start(name, NULL, 0))
+    fprintf(stderr, "Unknown effect %s\n", name);
+}
+
+/*
+ * Start an effect, or change the parameters of the one running, or stop it
+ * if name is empty.  Returns false if there is no such effect.
+ */
+bool effect_start(const char *name, const float *params, unsigned int num_params) {
+  const effect_t *effect = NULL;
+  for (unsigned int i = 0; i < sizeof(effects) / sizeof(*effects); i++)
+    if (strcmp(effects[i].name, name) == 0)
+      effect = &effects[i];
+  if (effect == NULL && *name != '\0')
+    return false;
+
+  pthread_mutex_lock(&effect_lock);
+  if (effect != current_effect)
+    restarted = true;
+  current_effect = effect;
+  memset(current_params, 0, sizeof(current_params));
+  for (unsigned int i = 0; i < num_params && i < EFFECT_MAX_PARAMS; i++)
+    current_params[i] = isfinite(params[i]) ? params[i] : 0;
+  pthread_mutex_unlock(&effect_lock);
+
+  printf(effect ? "Effect %s\n" : "Effects stopped\n", name);
+  return true;
+}
+
+double seconds(const struct timespec *ts) {
+  return ts->tv_sec + ts->tv_nsec / 1e9;
+}
+
+void *effects_func() {
+  pthread_barrier_init(&frame_start, NULL, num_bands);
+  pthread_barrier_init(&frame_done, NULL, num_bands);
+  pthread_t threads[MAX_THREADS];
+  for (unsigned int i = 1; i < num_bands; i++)
+    pthread_create(&threads[i], NULL, band_func, (void *) (uintptr_t) i);
+
+  const uint64_t frame_nsec = NSEC_PER_SECOND / effect_fps;
+  struct timespec deadline, start;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  start = deadline;
+
+  while (keepalive) {
+    pthread_mutex_lock(&effect_lock);
+    band_effect = current_effect;
+    memcpy(band_params, current_params, sizeof(band_params));
+    if (restarted) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      deadline = start;
+      restarted = false;
+    }
+    pthread_mutex_unlock(&effect_lock);
+
+    if (band_effect == NULL) {
+      struct timespec idle = { .tv_sec = 0, .tv_nsec = IDLE_SLEEP_NSEC };
+      nanosleep(&idle, NULL);
+      continue;
+    }
+
+    // render the frame due at the deadline, then show it then
+    band_panel = unused_panel(effect_panels);
+    band_time = seconds(&deadline) - seconds(&start);
+    pthread_barrier_wait(&frame_start);
+    render_band(0);
+    pthread_barrier_wait(&frame_done);
+
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    show_panel(band_panel);
+
+    // keep to the frame rate, but skip frames rather than catch up
+    uint64_t nsec = deadline.tv_nsec + frame_nsec;
+    deadline.tv_sec += nsec / NSEC_PER_SECOND;
+    deadline.tv_nsec = nsec % NSEC_PER_SECOND;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (seconds(&deadline) < seconds(&now))
+      deadline = now;
+  }
+
+  stopping = true;
+  pthread_barrier_wait(&frame_start);
+  for (unsigned int i = 1; i < num_bands; i++)
+    pthread_join(threads[i], NULL);
+  pthread_barrier_destroy(&frame_start);
+  pthread_barrier_destroy(&frame_done);
+
+  printf("Exiting effects thread\n");
+  return NULL;
+}
+
+// Free the effects' panels, once the drawing thread is done with them.
+void effects_close() {
+  for (int i = 0; i < 3; i++)
+    free(effect_panels[i]);
+}
@@ -0,0 +1,39 @@
+#ifndef _effects_h_
+#define _effects_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+
+/*
+ * Procedural effects rendered on the device, for generative content without
+ * a render host streaming panels.
+ *
+ * Effects are C kernels in a registry, each filling a band of panel rows for
+ * a time in seconds and up to EFFECT_MAX_PARAMS parameters (0 picks the
+ * effect's default).  The effect thread renders at effect_fps into panels of
+ * its own, split into latitude bands across effect_threads threads, and shows
+ * each as it is done.  Clients start, retune and stop effects with
+ * X2_MSG_EFFECT; panels they send meanwhile are shown until the next frame.
+ */
+
+#define EFFECT_MAX_PARAMS 8
+#define EFFECT_MAX_NAME 16
+
+
+typedef void (*effect_func_t)(uint8_t *panel, unsigned int row_begin, unsigned int row_end,
+    double t, const float *params);
+
+typedef struct {
+  const char *name;
+  effect_func_t render;
+} effect_t;
+
+
+extern void effects_init();
+extern bool effect_start(const char *name, const float *params, unsigned int num_params);
+extern void *effects_func();
+extern void effects_close();
+
+
+#endif
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "config.h"
+#include "drawing.h"
+#include "geometry.h"
+#include "ledscape.h"
+#include "strip-map.h"
+
+
+#define DEFAULT_PIXELS_PER_STRIP 17
+#define DEFAULT_NUM_STRIPS LEDSCAPE_NUM_STRIPS
+#define DEFAULT_NUM_ARMS 4
+#define DEFAULT_SLICES_PER_ARM 56
+
+
+// externs
+geometry_t geometry;
+
+
+void geometry_init() {
+  int pixels_per_strip = config_int("pixels_per_strip", DEFAULT_PIXELS_PER_STRIP);
+  int num_strips = config_int("num_strips", DEFAULT_NUM_STRIPS);
+  int num_arms = config_int("num_arms", DEFAULT_NUM_ARMS);
+  int slices_per_arm = config_int("slices_per_arm", DEFAULT_SLICES_PER_ARM);
+
+  if (pixels_per_strip <= 0 || slices_per_arm <= 0 || num_arms <= 0 || num_arms > MAX_ARMS
+      || num_strips <= 0 || num_strips > LEDSCAPE_NUM_STRIPS || num_strips % num_arms != 0) {
+    fprintf(stderr, "Invalid geometry: %d pixels x %d strips, %d arms x %d slices (at most %d strips, a multiple of at most %d arms)\n",
+        pixels_per_strip, num_strips, num_arms, slices_per_arm, LEDSCAPE_NUM_STRIPS, MAX_ARMS);
+    exit(1);
+  }
+
+  geometry.pixels_per_strip = pixels_per_strip;
+  geometry.num_strips = num_strips;
+  geometry.num_arms = num_arms;
+  geometry.slices_per_arm = slices_per_arm;
+
+  geometry.num_rows = num_strips / num_arms;
+  geometry.num_slices = num_arms * slices_per_arm;
+  geometry.panel_width = geometry.num_slices;
+  geometry.panel_height = geometry.num_rows * pixels_per_strip;
+  geometry.frame_size = LEDSCAPE_NUM_STRIPS * pixels_per_strip * PIXEL_SIZE;
+  geometry.panel_size = geometry.panel_width * geometry.panel_height * PIXEL_SIZE;
+  strip_map_init();
+
+  printf("Geometry: %u strips x %u pixels in %u rows, %u slices per rotation; %ux%u panels\n",
+      geometry.num_strips, geometry.pixels_per_strip, geometry.num_rows, geometry.num_slices,
+      geometry.panel_width, geometry.panel_height);
+}
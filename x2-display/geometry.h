@@ -0,0 +1,45 @@
+#ifndef _geometry_h_
+#define _geometry_h_
+
+#include <stddef.h>
+
+
+/*
+ * Physical layout of the sphere, read from the config file at startup.
+ *
+ * The strips are grouped into rows of num_arms strips, spaced evenly around
+ * the axis; each row covers pixels_per_strip lines of latitude.  A rotation
+ * is divided into num_arms * slices_per_arm angular slices, so every arm
+ * sweeps the whole circle and each slice column is refreshed num_arms times
+ * per rotation.
+ *
+ * A panel is num_slices wide and num_rows * pixels_per_strip high, with
+ * PIXEL_SIZE bytes per pixel.
+ */
+
+#define MAX_ARMS 16
+
+
+typedef struct {
+  unsigned int pixels_per_strip;
+  unsigned int num_strips;      // at most LEDSCAPE_NUM_STRIPS
+  unsigned int num_arms;
+  unsigned int slices_per_arm;
+
+  // derived from the above
+  unsigned int num_rows;
+  unsigned int num_slices;
+  unsigned int panel_width;
+  unsigned int panel_height;
+  size_t frame_size;  // bytes per ledscape frame
+  size_t panel_size;  // bytes per panel
+} geometry_t;
+
+
+extern geometry_t geometry;
+
+
+extern void geometry_init();
+
+
+#endif
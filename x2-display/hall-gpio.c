@@ -0,0 +1,47 @@
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "err.h"
+#include "gpio.h"
+#include "hall.h"
+
+
+unsigned int hall_sensor_gpio = 61;  // gpio1_29 = 32 + 29
+
+
+void hall_init() {
+  gpio_export(hall_sensor_gpio);
+  gpio_set_dir(hall_sensor_gpio, 0);
+  gpio_set_edge(hall_sensor_gpio, "rising");
+}
+
+int hall_open() {
+  printf("Listening for hall sensor on gpio %d\n", hall_sensor_gpio);
+  return gpio_fd_open(hall_sensor_gpio);
+}
+
+bool hall_wait(int fd, int timeout_msec) {
+  struct pollfd fdset[1];
+  char buf[GPIO_MAX_BUF];
+
+  memset((void*)fdset, 0, sizeof(fdset));
+  fdset[0].fd = fd;
+  fdset[0].events = POLLPRI;
+
+  // blocking read of gpio pin for hall effect sensor
+  poll(fdset, 1, timeout_msec);
+
+  if (!(fdset[0].revents & POLLPRI))
+    return false;
+
+  int n = read(fdset[0].fd, buf, GPIO_MAX_BUF);
+  if (n < 0)
+    error("ERROR reading from gpio");
+  return true;
+}
+
+void hall_close(int fd) {
+  gpio_fd_close(fd);
+}
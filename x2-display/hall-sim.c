@@ -0,0 +1,75 @@
+/*
+ * Simulated hall effect sensor.
+ * A timerfd fires once per rotation at the rate given by X2_SIM_RPS
+ * (rotations per second), standing in for the gpio interrupt on the BBB.
+ */
+
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "constants.h"
+#include "err.h"
+#include "hall.h"
+
+
+#define DEFAULT_SIM_RPS 7.5
+
+
+double sim_rps = DEFAULT_SIM_RPS;
+
+
+void hall_init() {
+  const char *env = getenv("X2_SIM_RPS");
+  if (env) {
+    double value = atof(env);
+    if (value > 0)
+      sim_rps = value;
+  }
+}
+
+int hall_open() {
+  printf("Simulating hall sensor at %.2f RPS\n", sim_rps);
+
+  int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+  if (fd < 0)
+    error("ERROR creating hall sensor timer");
+
+  uint64_t period_nsec = NSEC_PER_SECOND / sim_rps;
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = period_nsec / NSEC_PER_SECOND;
+  spec.it_interval.tv_nsec = period_nsec % NSEC_PER_SECOND;
+  spec.it_value = spec.it_interval;
+  if (timerfd_settime(fd, 0, &spec, NULL) < 0)
+    error("ERROR arming hall sensor timer");
+
+  return fd;
+}
+
+bool hall_wait(int fd, int timeout_msec) {
+  struct pollfd fdset[1];
+  memset((void*)fdset, 0, sizeof(fdset));
+  fdset[0].fd = fd;
+  fdset[0].events = POLLIN;
+
+  poll(fdset, 1, timeout_msec);
+
+  if (!(fdset[0].revents & POLLIN))
+    return false;
+
+  // number of rotations since the last read; missed ones are just dropped,
+  // as they would be with the real sensor
+  uint64_t expirations;
+  int n = read(fd, &expirations, sizeof(expirations));
+  if (n < 0)
+    error("ERROR reading hall sensor timer");
+  return true;
+}
+
+void hall_close(int fd) {
+  close(fd);
+}
@@ -0,0 +1,19 @@
+#ifndef _hall_h_
+#define _hall_h_
+
+#include <stdbool.h>
+
+
+/*
+ * Hall effect sensor that fires once per rotation of the sphere.
+ * hall-gpio.c reads the real sensor on the BBB; hall-sim.c fakes one with a
+ * timer so the display server can run without the hardware.
+ */
+
+extern void hall_init();
+extern int hall_open();
+extern bool hall_wait(int fd, int timeout_msec);  // true if a rotation started
+extern void hall_close(int fd);
+
+
+#endif
@@ -0,0 +1,222 @@
+/** \file
+ * Host-side simulation of the WS281x LED strip driver.
+ *
+ * Implements the ledscape API without a PRU so that the display server
+ * can run, be profiled and be load tested on an ordinary Linux box.
+ * Frames are copied into a "virtual sphere" buffer, and each transfer
+ * takes as long as the PRU would need to clock it out: 24 bits of
+ * 1.25 usec per pixel followed by the 50 usec reset.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include "ledscape.h"
+#include "ledscape-stats.h"
+#include "util.h"
+
+
+#define SIM_BIT_NSEC	1250
+#define SIM_RESET_NSEC	50000
+
+/** Cycles the PRU typically spends loading and slicing each bit */
+#define SIM_LOAD_CYCLES	90
+
+
+struct ledscape
+{
+	ledscape_frame_t * frames; // the two frame buffers the ARM renders into
+	ledscape_frame_t * sphere; // what is currently latched into the LEDs
+	unsigned num_pixels;
+	size_t frame_size;
+
+	uint64_t transfer_nsec; // how long one frame takes to clock out
+	uint64_t start_nsec; // when the in-flight frame started
+	uint64_t done_nsec; // when the in-flight frame will be latched
+
+	// will have a non-zero response when the transfer is done
+	uint32_t response;
+
+	ledscape_stats_collector_t stats;
+};
+
+
+static uint64_t
+sim_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/** Sleep until the monotonic clock reaches the given time */
+static void
+sim_sleep_until(
+	const uint64_t nsec
+)
+{
+	const struct timespec ts = {
+		.tv_sec		= nsec / 1000000000ULL,
+		.tv_nsec	= nsec % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+
+/** Retrieve one of the two frame buffers. */
+ledscape_frame_t *
+ledscape_frame(
+	ledscape_t * const leds,
+	unsigned int frame
+)
+{
+	if (frame >= 2)
+		return NULL;
+
+	return (ledscape_frame_t*)((uint8_t*) leds->frames + leds->frame_size * frame);
+}
+
+
+/** Initiate the transfer of a frame to the virtual sphere */
+void
+ledscape_draw(
+	ledscape_t * const leds,
+	unsigned int frame
+)
+{
+	// The PRU only acknowledges a new command once it has finished
+	// clocking out the previous one.
+	if (sim_now() < leds->done_nsec)
+		sim_sleep_until(leds->done_nsec);
+
+	memcpy(leds->sphere, ledscape_frame(leds, frame), leds->frame_size);
+
+	leds->start_nsec = sim_now();
+	leds->done_nsec = leds->start_nsec + leds->transfer_nsec;
+	leds->response = 0;
+}
+
+
+/** Wait for the current frame to finish transfering to the strips.
+ * \returns the transfer time in PRU cycles, like the real driver.
+ */
+uint32_t
+ledscape_wait(
+	ledscape_t * const leds
+)
+{
+	if (leds->response)
+	{
+		const uint32_t response = leds->response;
+		leds->response = 0;
+		return response;
+	}
+
+	sim_sleep_until(leds->done_nsec);
+
+	// Report what the PRU would have measured
+	const uint32_t bits = leds->num_pixels * 24;
+	const ledscape_frame_stats_t frame = {
+		.load_cycles	= bits * SIM_LOAD_CYCLES,
+		.clock_cycles	= bits * (SIM_BIT_NSEC * LEDSCAPE_CYCLES_PER_USEC / 1000 - SIM_LOAD_CYCLES),
+		.reset_cycles	= SIM_RESET_NSEC * LEDSCAPE_CYCLES_PER_USEC / 1000,
+		.overruns	= 0,
+	};
+	ledscape_stats_record(&leds->stats, &frame);
+
+	return frame.load_cycles + frame.clock_cycles + frame.reset_cycles;
+}
+
+
+void
+ledscape_stats(
+	ledscape_t * const leds,
+	ledscape_stats_t * const stats
+)
+{
+	ledscape_stats_read(&leds->stats, stats);
+}
+
+
+void
+ledscape_totals(
+	ledscape_t * const leds,
+	uint64_t * const frames,
+	uint64_t * const overruns
+)
+{
+	ledscape_stats_totals(&leds->stats, frames, overruns);
+}
+
+
+ledscape_t *
+ledscape_init(
+	unsigned num_pixels
+)
+{
+	const size_t frame_size = num_pixels * LEDSCAPE_NUM_STRIPS * 4;
+
+	ledscape_t * const leds = calloc(1, sizeof(*leds));
+	if (!leds)
+		die("calloc failed: %s", strerror(errno));
+
+	*leds = (ledscape_t) {
+		.frames		= calloc(2, frame_size),
+		.sphere		= calloc(1, frame_size),
+		.num_pixels	= num_pixels,
+		.frame_size	= frame_size,
+		.transfer_nsec	= num_pixels * 24 * SIM_BIT_NSEC + SIM_RESET_NSEC,
+		.response	= 1, // startup acknowledgement, as from the PRU
+	};
+
+	if (!leds->frames || !leds->sphere)
+		die("calloc failed: %s", strerror(errno));
+
+	ledscape_stats_init(&leds->stats);
+
+	printf("%s: simulated: %u pixels, %zu byte frames, %"PRIu64" usec per transfer\n",
+		__func__,
+		num_pixels,
+		frame_size,
+		leds->transfer_nsec / 1000
+	);
+
+	return leds;
+}
+
+
+void
+ledscape_close(
+	ledscape_t * const leds
+)
+{
+	// Let the last frame finish, as the PRU would before halting
+	sim_sleep_until(leds->done_nsec);
+
+	free(leds->frames);
+	free(leds->sphere);
+	free(leds);
+}
+
+
+void
+ledscape_set_color(
+	ledscape_frame_t * const frame,
+	uint8_t strip,
+	uint8_t pixel,
+	uint8_t r,
+	uint8_t g,
+	uint8_t b
+)
+{
+	ledscape_pixel_t * const p = &frame[pixel].strip[strip];
+	p->r = r;
+	p->g = g;
+	p->b = b;
+}
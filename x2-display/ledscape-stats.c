@@ -0,0 +1,140 @@
+/** \file
+ * Rolling histograms of the PRU frame transfer statistics.
+ *
+ * Each frame is added to the histograms as it completes, and taken out
+ * again LEDSCAPE_STATS_WINDOW frames later, so the histograms always
+ * describe the recent past without any decay arithmetic.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "ledscape-stats.h"
+
+
+static unsigned
+hist_bucket(
+	const uint32_t cycles
+)
+{
+	const unsigned bucket = cycles
+		/ (LEDSCAPE_CYCLES_PER_USEC * LEDSCAPE_HIST_BUCKET_USEC);
+
+	return bucket < LEDSCAPE_HIST_BUCKETS ? bucket : LEDSCAPE_HIST_BUCKETS - 1;
+}
+
+
+static void
+hist_add(
+	ledscape_hist_t * const hist,
+	const uint32_t cycles,
+	const int delta
+)
+{
+	hist->count[hist_bucket(cycles)] += delta;
+	hist->total += delta;
+}
+
+
+static void
+stats_add(
+	ledscape_stats_t * const stats,
+	const ledscape_frame_stats_t * const frame,
+	const int delta
+)
+{
+	hist_add(&stats->load, frame->load_cycles, delta);
+	hist_add(&stats->clock, frame->clock_cycles, delta);
+	hist_add(&stats->reset, frame->reset_cycles, delta);
+	hist_add(&stats->transfer,
+		frame->load_cycles + frame->clock_cycles + frame->reset_cycles,
+		delta
+	);
+}
+
+
+void
+ledscape_stats_init(
+	ledscape_stats_collector_t * const collector
+)
+{
+	memset(collector, 0, sizeof(*collector));
+	pthread_mutex_init(&collector->lock, NULL);
+}
+
+
+void
+ledscape_stats_record(
+	ledscape_stats_collector_t * const collector,
+	const ledscape_frame_stats_t * const frame
+)
+{
+	pthread_mutex_lock(&collector->lock);
+
+	ledscape_stats_t * const stats = &collector->stats;
+	ledscape_frame_stats_t * const slot = &collector->window[collector->next];
+
+	if (stats->frames >= LEDSCAPE_STATS_WINDOW)
+		stats_add(stats, slot, -1);
+
+	*slot = *frame;
+	stats_add(stats, slot, 1);
+	collector->next = (collector->next + 1) % LEDSCAPE_STATS_WINDOW;
+
+	// the totals are also read without the lock by ledscape_stats_totals
+	__atomic_store_n(&stats->frames, stats->frames + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->overruns, stats->overruns + frame->overruns,
+		__ATOMIC_RELAXED);
+	stats->last = *frame;
+
+	pthread_mutex_unlock(&collector->lock);
+}
+
+
+void
+ledscape_stats_read(
+	ledscape_stats_collector_t * const collector,
+	ledscape_stats_t * const stats
+)
+{
+	pthread_mutex_lock(&collector->lock);
+	*stats = collector->stats;
+	pthread_mutex_unlock(&collector->lock);
+}
+
+
+void
+ledscape_stats_totals(
+	ledscape_stats_collector_t * const collector,
+	uint64_t * const frames,
+	uint64_t * const overruns
+)
+{
+	*frames = __atomic_load_n(&collector->stats.frames, __ATOMIC_RELAXED);
+	*overruns = __atomic_load_n(&collector->stats.overruns, __ATOMIC_RELAXED);
+}
+
+
+unsigned
+ledscape_hist_percentile(
+	const ledscape_hist_t * const hist,
+	const double pct
+)
+{
+	if (hist->total == 0)
+		return 0;
+
+	uint32_t target = hist->total * pct / 100;
+	if (target == 0)
+		target = 1;
+	uint32_t seen = 0;
+
+	for (unsigned i = 0 ; i < LEDSCAPE_HIST_BUCKETS ; i++)
+	{
+		seen += hist->count[i];
+		if (seen >= target)
+			return (i + 1) * LEDSCAPE_HIST_BUCKET_USEC;
+	}
+
+	return LEDSCAPE_HIST_BUCKETS * LEDSCAPE_HIST_BUCKET_USEC;
+}
@@ -0,0 +1,49 @@
+/** \file
+ * Collection of per-frame transfer statistics, shared by the backends.
+ */
+#ifndef _ledscape_stats_h_
+#define _ledscape_stats_h_
+
+#include <pthread.h>
+#include "ledscape.h"
+
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	ledscape_stats_t stats;
+
+	// the frames in the histograms, to age them out again
+	ledscape_frame_stats_t window[LEDSCAPE_STATS_WINDOW];
+	unsigned next;
+} ledscape_stats_collector_t;
+
+
+extern void
+ledscape_stats_init(
+	ledscape_stats_collector_t * const collector
+);
+
+
+extern void
+ledscape_stats_record(
+	ledscape_stats_collector_t * const collector,
+	const ledscape_frame_stats_t * const frame
+);
+
+
+extern void
+ledscape_stats_read(
+	ledscape_stats_collector_t * const collector,
+	ledscape_stats_t * const stats
+);
+
+
+extern void
+ledscape_stats_totals(
+	ledscape_stats_collector_t * const collector,
+	uint64_t * const frames,
+	uint64_t * const overruns
+);
+
+#endif
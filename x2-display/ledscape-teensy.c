@@ -0,0 +1,388 @@
+/** \file
+ * WS281x output through Teensy 3 boards over USB serial.
+ *
+ * Implements the ledscape API for boards running the OctoWS2811
+ * VideoDisplay firmware, each driving 8 of the frame's strips, for
+ * installations with more strips or longer ones than the BBB's PRU
+ * and GPIO pins can drive.  Board i, the i'th of the teensy_devices
+ * setting, drives strips 8i to 8i + 7.
+ *
+ * ledscape_draw() bitslices the frame into each board's half of a
+ * double buffer while the writer threads are still sending the
+ * other half, then hands the new frame to all of them at once.
+ * Each board has its own writer thread doing non-blocking writes,
+ * so a slow board does not hold up the others, and ledscape_wait()
+ * returns when every board has the whole frame.  The first board is
+ * sent master frames and the others slave frames, which they latch
+ * on the first board's frame sync pulse, so all the strips change
+ * together.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "bitslice.h"
+#include "config.h"
+#include "ledscape.h"
+#include "ledscape-stats.h"
+#include "util.h"
+
+
+#define TEENSY_STRIPS		8	// per board
+#define TEENSY_MAX_DEVICES	(LEDSCAPE_NUM_STRIPS / TEENSY_STRIPS)
+#define TEENSY_HEADER_SIZE	3	// start character, u16 frame sync delay
+#define TEENSY_MASTER_FRAME	'*'	// show now and pulse frame sync
+#define TEENSY_SLAVE_FRAME	'$'	// show on the frame sync pulse
+#define TEENSY_TIMEOUT_MSEC	1000	// before giving up on a board
+#define TEENSY_DEFAULT_DEVICES	"/dev/ttyACM0 /dev/ttyACM1 /dev/ttyACM2"
+
+
+typedef struct
+{
+	ledscape_t * leds;
+	char * path;
+	int fd; // -1 once the board has failed
+	pthread_t thread;
+	uint8_t * buffers[2]; // frames of odd and even generations
+} teensy_t;
+
+
+struct ledscape
+{
+	ledscape_frame_t * frames; // the two frame buffers the ARM renders into
+	unsigned num_pixels;
+	size_t frame_size;
+	size_t packet_size; // bytes sent to each board per frame
+	uint8_t * rgb; // frame as an image for bitslice(), strips across
+
+	unsigned num_devices;
+	teensy_t devices[TEENSY_MAX_DEVICES];
+
+	// shared with the writer threads
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned generation; // frames handed to the writers
+	unsigned written; // boards done with the current generation
+	bool closing;
+
+	uint32_t response; // startup acknowledgement, as from the PRU
+	uint64_t slice_nsec; // bitslicing the current frame
+	uint64_t start_nsec; // when it was handed to the writers
+
+	ledscape_stats_collector_t stats;
+};
+
+
+static uint64_t
+teensy_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/** Send a whole frame to a board, waiting for room as needed.
+ * A board that errors or stops reading is closed and skipped from then
+ * on; a partial frame would leave it out of step.
+ */
+static void
+teensy_write(
+	teensy_t * const dev,
+	const uint8_t * buf,
+	size_t len
+)
+{
+	while (dev->fd >= 0 && len > 0)
+	{
+		const ssize_t rc = write(dev->fd, buf, len);
+		if (rc > 0)
+		{
+			buf += rc;
+			len -= rc;
+			continue;
+		}
+
+		if (rc < 0 && errno != EAGAIN && errno != EINTR)
+		{
+			warn("%s: %s; no longer driving it\n", dev->path, strerror(errno));
+		} else {
+			struct pollfd pfd = { .fd = dev->fd, .events = POLLOUT };
+			if (poll(&pfd, 1, TEENSY_TIMEOUT_MSEC) != 0)
+				continue;
+			warn("%s: not reading; no longer driving it\n", dev->path);
+		}
+
+		close(dev->fd);
+		dev->fd = -1;
+	}
+}
+
+
+static void *
+teensy_func(
+	void * const arg
+)
+{
+	teensy_t * const dev = arg;
+	ledscape_t * const leds = dev->leds;
+	unsigned done = 0;
+
+	pthread_mutex_lock(&leds->lock);
+	while (1)
+	{
+		while (leds->generation == done && !leds->closing)
+			pthread_cond_wait(&leds->cond, &leds->lock);
+		if (leds->generation == done)
+			break;
+
+		done = leds->generation;
+		pthread_mutex_unlock(&leds->lock);
+
+		teensy_write(dev, dev->buffers[done % 2], leds->packet_size);
+
+		pthread_mutex_lock(&leds->lock);
+		leds->written++;
+		pthread_cond_broadcast(&leds->cond);
+	}
+	pthread_mutex_unlock(&leds->lock);
+
+	return NULL;
+}
+
+
+/** Retrieve one of the two frame buffers. */
+ledscape_frame_t *
+ledscape_frame(
+	ledscape_t * const leds,
+	unsigned int frame
+)
+{
+	if (frame >= 2)
+		return NULL;
+
+	return (ledscape_frame_t*)((uint8_t*) leds->frames + leds->frame_size * frame);
+}
+
+
+/** Slice a frame for the boards and start sending it.
+ *
+ * The slicing overlaps the sending of the previous frame; like the
+ * PRU, the new frame only starts once that one is done.
+ */
+void
+ledscape_draw(
+	ledscape_t * const leds,
+	unsigned int frame
+)
+{
+	const uint64_t slice_start = teensy_now();
+	const ledscape_frame_t * const in = ledscape_frame(leds, frame);
+	const unsigned num_pixels = leds->num_pixels;
+
+	// bitslice() takes rows of RGB strips, bottom up
+	for (unsigned pixel = 0 ; pixel < num_pixels ; pixel++)
+	{
+		uint8_t * row = leds->rgb + (num_pixels - pixel - 1) * LEDSCAPE_NUM_STRIPS * 3;
+		for (unsigned strip = 0 ; strip < LEDSCAPE_NUM_STRIPS ; strip++)
+		{
+			const ledscape_pixel_t * const p = &in[pixel].strip[strip];
+			*row++ = p->r;
+			*row++ = p->g;
+			*row++ = p->b;
+		}
+	}
+
+	const unsigned next = leds->generation + 1;
+	for (unsigned i = 0 ; i < leds->num_devices ; i++)
+	{
+		uint8_t * const out = leds->devices[i].buffers[next % 2];
+		out[0] = i == 0 ? TEENSY_MASTER_FRAME : TEENSY_SLAVE_FRAME;
+		out[1] = out[2] = 0;
+		bitslice(out + TEENSY_HEADER_SIZE, NULL, leds->rgb,
+			LEDSCAPE_NUM_STRIPS, num_pixels, i * TEENSY_STRIPS);
+	}
+	const uint64_t slice_nsec = teensy_now() - slice_start;
+
+	pthread_mutex_lock(&leds->lock);
+	while (leds->written < leds->num_devices)
+		pthread_cond_wait(&leds->cond, &leds->lock);
+	leds->generation = next;
+	leds->written = 0;
+	leds->slice_nsec = slice_nsec;
+	leds->start_nsec = teensy_now();
+	pthread_cond_broadcast(&leds->cond);
+	pthread_mutex_unlock(&leds->lock);
+}
+
+
+/** Wait for every board to have the current frame.
+ * \returns the transfer time in PRU cycles, like the real driver.
+ */
+uint32_t
+ledscape_wait(
+	ledscape_t * const leds
+)
+{
+	if (leds->response)
+	{
+		const uint32_t response = leds->response;
+		leds->response = 0;
+		return response;
+	}
+
+	pthread_mutex_lock(&leds->lock);
+	while (leds->written < leds->num_devices)
+		pthread_cond_wait(&leds->cond, &leds->lock);
+	const uint64_t write_nsec = teensy_now() - leds->start_nsec;
+	const uint64_t slice_nsec = leds->slice_nsec;
+	pthread_mutex_unlock(&leds->lock);
+
+	// Report slicing as the load and writing as the clock out
+	const ledscape_frame_stats_t frame = {
+		.load_cycles	= slice_nsec * LEDSCAPE_CYCLES_PER_USEC / 1000,
+		.clock_cycles	= write_nsec * LEDSCAPE_CYCLES_PER_USEC / 1000,
+		.reset_cycles	= 0,
+		.overruns	= 0,
+	};
+	ledscape_stats_record(&leds->stats, &frame);
+
+	return frame.load_cycles + frame.clock_cycles + 1;
+}
+
+
+void
+ledscape_stats(
+	ledscape_t * const leds,
+	ledscape_stats_t * const stats
+)
+{
+	ledscape_stats_read(&leds->stats, stats);
+}
+
+
+void
+ledscape_totals(
+	ledscape_t * const leds,
+	uint64_t * const frames,
+	uint64_t * const overruns
+)
+{
+	ledscape_stats_totals(&leds->stats, frames, overruns);
+}
+
+
+ledscape_t *
+ledscape_init(
+	unsigned num_pixels
+)
+{
+	const size_t frame_size = num_pixels * LEDSCAPE_NUM_STRIPS * 4;
+
+	ledscape_t * const leds = calloc(1, sizeof(*leds));
+	if (!leds)
+		die("calloc failed: %s", strerror(errno));
+
+	*leds = (ledscape_t) {
+		.frames		= calloc(2, frame_size),
+		.rgb		= calloc(num_pixels * LEDSCAPE_NUM_STRIPS, 3),
+		.num_pixels	= num_pixels,
+		.frame_size	= frame_size,
+		.packet_size	= TEENSY_HEADER_SIZE + num_pixels * 3 * 8,
+		.response	= 1,
+	};
+
+	if (!leds->frames || !leds->rgb)
+		die("calloc failed: %s", strerror(errno));
+
+	pthread_mutex_init(&leds->lock, NULL);
+	pthread_cond_init(&leds->cond, NULL);
+	ledscape_stats_init(&leds->stats);
+
+	char * const paths = strdup(config_string("teensy_devices", TEENSY_DEFAULT_DEVICES));
+	char * saveptr = NULL;
+	for (char * path = strtok_r(paths, " \t,", &saveptr) ; path ; path = strtok_r(NULL, " \t,", &saveptr))
+	{
+		if (leds->num_devices == TEENSY_MAX_DEVICES)
+			die("at most %d teensy_devices for %d strips\n", TEENSY_MAX_DEVICES, LEDSCAPE_NUM_STRIPS);
+
+		teensy_t * const dev = &leds->devices[leds->num_devices++];
+		dev->leds = leds;
+		dev->path = strdup(path);
+		dev->fd = serial_open(path);
+		if (dev->fd < 0)
+			die("%s: %s\n", path, strerror(errno));
+		for (int i = 0 ; i < 2 ; i++)
+			if (!(dev->buffers[i] = calloc(1, leds->packet_size)))
+				die("calloc failed: %s", strerror(errno));
+	}
+	free(paths);
+	if (leds->num_devices == 0)
+		die("no teensy_devices\n");
+
+	// nothing is in flight yet
+	leds->written = leds->num_devices;
+	for (unsigned i = 0 ; i < leds->num_devices ; i++)
+		pthread_create(&leds->devices[i].thread, NULL, teensy_func, &leds->devices[i]);
+
+	printf("%s: %u Teensy boards, %u pixels, %zu bytes per board per frame\n",
+		__func__,
+		leds->num_devices,
+		num_pixels,
+		leds->packet_size
+	);
+
+	return leds;
+}
+
+
+void
+ledscape_close(
+	ledscape_t * const leds
+)
+{
+	// Let the writers finish the last frame
+	pthread_mutex_lock(&leds->lock);
+	leds->closing = true;
+	pthread_cond_broadcast(&leds->cond);
+	pthread_mutex_unlock(&leds->lock);
+
+	for (unsigned i = 0 ; i < leds->num_devices ; i++)
+	{
+		teensy_t * const dev = &leds->devices[i];
+		pthread_join(dev->thread, NULL);
+		if (dev->fd >= 0)
+			close(dev->fd);
+		free(dev->buffers[0]);
+		free(dev->buffers[1]);
+		free(dev->path);
+	}
+
+	free(leds->frames);
+	free(leds->rgb);
+	free(leds);
+}
+
+
+void
+ledscape_set_color(
+	ledscape_frame_t * const frame,
+	uint8_t strip,
+	uint8_t pixel,
+	uint8_t r,
+	uint8_t g,
+	uint8_t b
+)
+{
+	ledscape_pixel_t * const p = &frame[pixel].strip[strip];
+	p->r = r;
+	p->g = g;
+	p->b = b;
+}
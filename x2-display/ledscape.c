@@ -10,34 +10,23 @@
 #include <errno.h>
 #include <unistd.h>
 #include "ledscape.h"
+#include "ledscape-stats.h"
 #include "pru.h"
+#include "wiring.h"
 
 
 /** GPIO pins used by the LEDscape.
  *
  * The device tree should handle this configuration for us, but it
  * seems horribly broken and won't configure these pins as outputs.
- * So instead we have to repeat them here as well.
- *
- * If these are changed, be sure to check the mappings in
- * ws281x.p!
- *
- * \todo: Find a way to unify this with the defines in the .p file
+ * So instead we set them up here, from the same wiring.conf that
+ * the firmware's pin masks are generated from.
  */
-static const uint8_t gpios0[] = {
-	2, 3, 8, 9, 7, 10, 11, 14, 15, 20, 22, 23, 26, 27, 30, 31,
-};
-
-static const uint8_t gpios1[] = {
-	12, 13, 14, 15, 16, 17, 18, 19, 28, 29,
-};
-
-static const uint8_t gpios2[] = {
-	1, 2, 3, 4, 5,
-};
-
-static const uint8_t gpios3[] = {
-	16, 19,
+static const struct {
+	uint8_t bank;
+	uint8_t pin;
+} gpios[] = {
+	WIRING_PINS
 };
 
 #define ARRAY_COUNT(a) ((sizeof(a) / sizeof(*a)))
@@ -63,6 +52,13 @@ typedef struct
 
 	// will have a non-zero response written when done
 	volatile unsigned response;
+
+	// statistics of the last frame, written before the response
+	volatile uint32_t frames;
+	volatile uint32_t load_cycles;
+	volatile uint32_t bit_cycles; // whole bits, load included
+	volatile uint32_t reset_cycles;
+	volatile uint32_t overruns;
 } __attribute__((__packed__)) ws281x_command_t;
 
 
@@ -72,6 +68,8 @@ struct ledscape
 	pru_t * pru;
 	unsigned num_pixels;
 	size_t frame_size;
+	uint32_t frames; // frames the statistics have been collected for
+	ledscape_stats_collector_t stats;
 };
 
 
@@ -120,12 +118,48 @@ ledscape_wait(
 		uint32_t response = leds->ws281x->response;
 		if (!response)
 			continue;
+
+		// The startup acknowledgement has no statistics with it
+		ws281x_command_t * const ws281x = leds->ws281x;
+		if (ws281x->frames != leds->frames)
+		{
+			const ledscape_frame_stats_t frame = {
+				.load_cycles	= ws281x->load_cycles,
+				.clock_cycles	= ws281x->bit_cycles - ws281x->load_cycles,
+				.reset_cycles	= ws281x->reset_cycles,
+				.overruns	= ws281x->overruns,
+			};
+			ledscape_stats_record(&leds->stats, &frame);
+			leds->frames = ws281x->frames;
+		}
+
 		leds->ws281x->response = 0;
 		return response;
 	}
 }
 
 
+void
+ledscape_stats(
+	ledscape_t * const leds,
+	ledscape_stats_t * const stats
+)
+{
+	ledscape_stats_read(&leds->stats, stats);
+}
+
+
+void
+ledscape_totals(
+	ledscape_t * const leds,
+	uint64_t * const frames,
+	uint64_t * const overruns
+)
+{
+	ledscape_stats_totals(&leds->stats, frames, overruns);
+}
+
+
 ledscape_t *
 ledscape_init(
 	unsigned num_pixels
@@ -154,17 +188,14 @@ ledscape_init(
 		.command	= 0,
 		.response	= 0,
 		.num_pixels	= leds->num_pixels,
+		.frames		= 0,
 	};
 
+	ledscape_stats_init(&leds->stats);
+
 	// Configure all of our output pins.
-	for (unsigned i = 0 ; i < ARRAY_COUNT(gpios0) ; i++)
-		pru_gpio(0, gpios0[i], 1, 0);
-	for (unsigned i = 0 ; i < ARRAY_COUNT(gpios1) ; i++)
-		pru_gpio(1, gpios1[i], 1, 0);
-	for (unsigned i = 0 ; i < ARRAY_COUNT(gpios2) ; i++)
-		pru_gpio(2, gpios2[i], 1, 0);
-	for (unsigned i = 0 ; i < ARRAY_COUNT(gpios3) ; i++)
-		pru_gpio(3, gpios3[i], 1, 0);
+	for (unsigned i = 0 ; i < ARRAY_COUNT(gpios) ; i++)
+		pru_gpio(gpios[i].bank, gpios[i].pin, 1, 0);
 
 	// Initiate the PRU program
 	pru_exec(pru, "./ws281x.bin");
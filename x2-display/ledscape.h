@@ -45,6 +45,55 @@ typedef struct {
 typedef struct ledscape ledscape_t;
 
 
+/** The PRU cycle counter runs at 200 MHz */
+#define LEDSCAPE_CYCLES_PER_USEC 200
+
+
+/** Timing of one frame transfer, as measured by the PRU.
+ *
+ * Each bit has 650 ns of idle time in which the PRU loads and slices
+ * the next bit of every strip; a bit whose load takes longer than that
+ * is an overrun, and stretches the bit.
+ */
+typedef struct {
+	uint32_t load_cycles; // loading and slicing pixel data
+	uint32_t clock_cycles; // clocking the bits out, less the load
+	uint32_t reset_cycles; // holding the line low to latch the frame
+	uint32_t overruns; // bits whose load overran the idle time
+} ledscape_frame_stats_t;
+
+
+/** Histogram of durations in microseconds.
+ *
+ * Buckets are LEDSCAPE_HIST_BUCKET_USEC wide; the last one also counts
+ * everything longer.
+ */
+#define LEDSCAPE_HIST_BUCKETS 64
+#define LEDSCAPE_HIST_BUCKET_USEC 16
+
+typedef struct {
+	uint32_t count[LEDSCAPE_HIST_BUCKETS];
+	uint32_t total;
+} ledscape_hist_t;
+
+
+/** Frame statistics collected by ledscape_wait.
+ *
+ * The histograms cover the last LEDSCAPE_STATS_WINDOW frames.
+ */
+#define LEDSCAPE_STATS_WINDOW 1024
+
+typedef struct {
+	uint64_t frames; // transfers completed since startup
+	uint64_t overruns; // overrun bits since startup
+	ledscape_frame_stats_t last;
+	ledscape_hist_t load;
+	ledscape_hist_t clock;
+	ledscape_hist_t reset;
+	ledscape_hist_t transfer; // all of the above
+} ledscape_stats_t;
+
+
 extern ledscape_t *
 ledscape_init(
 	unsigned num_pixels
@@ -82,6 +131,35 @@ ledscape_wait(
 );
 
 
+/** Copy out the frame statistics; safe to call from any thread. */
+extern void
+ledscape_stats(
+	ledscape_t * const leds,
+	ledscape_stats_t * const stats
+);
+
+
+/** Read just the frame and overrun totals, without taking the lock that
+ * ledscape_wait records under, so that polling them never delays a draw.
+ */
+extern void
+ledscape_totals(
+	ledscape_t * const leds,
+	uint64_t * const frames,
+	uint64_t * const overruns
+);
+
+
+/** Duration in usec below which pct percent of the histogram falls.
+ * Returns 0 for an empty histogram.
+ */
+extern unsigned
+ledscape_hist_percentile(
+	const ledscape_hist_t * const hist,
+	const double pct
+);
+
+
 extern void
 ledscape_close(
 	ledscape_t * const leds
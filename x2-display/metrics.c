@@ -0,0 +1,184 @@
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "cluster.h"
+#include "config.h"
+#include "drawing.h"
+#include "err.h"
+#include "metrics.h"
+#include "power.h"
+#include "timing.h"
+#include "trace.h"
+#include "util.h"
+#include "x2-server.h"
+
+
+#define DEFAULT_METRICS_PORT 10001
+#define POLL_TIMEOUT (3 * 1000)  // 3 seconds
+#define REQUEST_TIMEOUT 1000     // 1 second
+#define MAX_REQUEST 2048
+
+
+// externs
+metrics_t metrics;
+
+
+int metrics_port;
+
+// histogram bucket bounds, in seconds
+const double bucket_bounds[] = {
+  0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+  0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1,
+};
+#define NUM_BOUNDS (sizeof(bucket_bounds) / sizeof(bucket_bounds[0]))
+
+
+void metrics_init() {
+  metrics_port = config_int("metrics_port", DEFAULT_METRICS_PORT);
+}
+
+void write_gauge(FILE *out, const char *name, const char *help, double value) {
+  fprintf(out, "# HELP %s %s\n# TYPE %s gauge\n%s %.9g\n", name, help, name, name, value);
+}
+
+void write_counter(FILE *out, const char *name, const char *help, uint64_t value) {
+  fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", name, help, name, name, value);
+}
+
+void write_histogram(FILE *out, const char *name, const char *help, const hdr_hist_t *hist) {
+  fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  for (unsigned int i = 0; i < NUM_BOUNDS; i++)
+    fprintf(out, "%s_bucket{le=\"%g\"} %" PRIu64 "\n", name, bucket_bounds[i],
+        hdr_count_le(hist, bucket_bounds[i] * NSEC_PER_SECOND));
+  fprintf(out, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, hist->count);
+  fprintf(out, "%s_sum %.9f\n", name, (double) hist->sum / NSEC_PER_SECOND);
+  fprintf(out, "%s_count %" PRIu64 "\n", name, hist->count);
+}
+
+void write_metrics(FILE *out) {
+  write_gauge(out, "x2_rotations_per_second", "Measured rotation rate of the sphere.", rps);
+  write_gauge(out, "x2_panels_per_second", "Rotations drawn per second.", fps);
+  write_gauge(out, "x2_slices_per_rotation", "Current angular resolution.", slices_per_rotation);
+  write_gauge(out, "x2_slice_cost_seconds", "Smoothed time to render and clock out a slice.",
+      (double) slice_usec / USEC_PER_SECOND);
+  write_gauge(out, "x2_estimated_current_amps", "Estimated LED current over the last rotation, when limiting.",
+      average_amps);
+  write_gauge(out, "x2_cluster_skew_seconds", "Spread of the spheres' swaps of the last cluster panel, on the coordinator.",
+      cluster_skew);
+  write_gauge(out, "x2_cluster_clock_offset_seconds", "Coordinator clock less ours, on a cluster node.",
+      cluster_clock_offset);
+  write_gauge(out, "x2_cluster_swap_error_seconds", "Our last cluster panel swap less its presentation time.",
+      cluster_swap_error);
+
+  write_counter(out, "x2_rotations_total", "Hall sensor pulses.", metrics_get(&metrics.rotations));
+  write_counter(out, "x2_slices_drawn_total", "Slices sent to the LEDs.", metrics_get(&metrics.slices_drawn));
+  write_counter(out, "x2_slices_dropped_total", "Slices not drawn before the next rotation began.",
+      metrics_get(&metrics.slices_dropped));
+  write_counter(out, "x2_slice_deadline_misses_total", "Slices that finished after their end time.",
+      metrics_get(&metrics.deadline_misses));
+  write_counter(out, "x2_slices_current_limited_total", "Slices scaled down to the current limit.",
+      metrics_get(&metrics.slices_limited));
+  write_counter(out, "x2_rotations_current_limited_total", "Rotations scaled down to the average current limit.",
+      metrics_get(&metrics.rotations_limited));
+  write_counter(out, "x2_columns_composited_total", "Panel columns recomposed with overlay layers.",
+      metrics_get(&metrics.columns_composited));
+  write_counter(out, "x2_connections_total", "Client connections accepted.",
+      metrics_get(&metrics.connections));
+  write_counter(out, "x2_panels_received_total", "Panels received from clients.",
+      metrics_get(&metrics.panels_received));
+  write_counter(out, "x2_received_bytes_total", "Panel bytes received from clients.",
+      metrics_get(&metrics.bytes_received));
+
+  uint64_t frames, overruns;
+  ledscape_totals(leds, &frames, &overruns);
+  write_counter(out, "x2_pru_frames_total", "Frames clocked out by the PRU.", frames);
+  write_counter(out, "x2_pru_overrun_bits_total", "Bits whose load overran the PRU idle time.", overruns);
+
+  hdr_hist_t hists[TRACE_NUM_HISTS];
+  trace_histograms(hists);
+  write_histogram(out, "x2_slice_seconds", "Slice start to PRU done.", &hists[TRACE_HIST_SLICE]);
+  write_histogram(out, "x2_pru_transfer_seconds", "PRU submit to PRU done.", &hists[TRACE_HIST_TRANSFER]);
+  write_histogram(out, "x2_render_seconds", "Time to render a slice.", &hists[TRACE_HIST_RENDER]);
+  write_histogram(out, "x2_slice_start_late_seconds", "Lateness of slice starts.", &hists[TRACE_HIST_JITTER]);
+  write_histogram(out, "x2_rotation_seconds", "Rotation period.", &hists[TRACE_HIST_ROTATION]);
+}
+
+/*
+ * Read an HTTP request up to the end of its headers, and return whether it
+ * was for the metrics.
+ */
+bool read_request(int connfd) {
+  char request[MAX_REQUEST + 1];
+  int len = 0;
+
+  struct pollfd fdset = { .fd = connfd, .events = POLLIN };
+  while (len < MAX_REQUEST) {
+    if (poll(&fdset, 1, REQUEST_TIMEOUT) <= 0)
+      return false;
+    int n = read(connfd, request + len, MAX_REQUEST - len);
+    if (n <= 0)
+      return false;
+    len += n;
+    request[len] = '\0';
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+      break;
+  }
+
+  return strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0;
+}
+
+void serve_request(int connfd) {
+  char *body = NULL;
+  size_t body_len = 0;
+  FILE *out = open_memstream(&body, &body_len);
+  if (out == NULL)
+    error("ERROR allocating metrics");
+
+  const char *status;
+  if (read_request(connfd)) {
+    status = "200 OK";
+    write_metrics(out);
+  } else {
+    status = "404 Not Found";
+    fprintf(out, "metrics are at /metrics\n");
+  }
+  fclose(out);
+
+  char header[256];
+  int header_len = snprintf(header, sizeof(header),
+      "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+      status, body_len);
+  write_all(connfd, header, header_len);
+  write_all(connfd, body, body_len);
+  free(body);
+}
+
+void *metrics_func() {
+  if (metrics_port == 0)
+    return NULL;
+
+  printf("Metrics on http://localhost:%d/metrics\n", metrics_port);
+  int listenfd = socket_init(metrics_port);
+
+  struct pollfd fdset = { .fd = listenfd, .events = POLLIN };
+  while (keepalive) {
+    if (poll(&fdset, 1, POLL_TIMEOUT) <= 0 || !(fdset.revents & POLLIN))
+      continue;
+
+    int connfd = accept(listenfd, NULL, NULL);
+    if (connfd < 0)
+      continue;
+    serve_request(connfd);
+    close(connfd);
+  }
+
+  close(listenfd);
+
+  printf("Exiting metrics thread\n");
+  return NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef _metrics_h_
+#define _metrics_h_
+
+#include <inttypes.h>
+#include "constants.h"
+
+
+/*
+ * Counters for the metrics endpoint, in Prometheus text format over HTTP.
+ *
+ * Each thread only ever adds to its own counters with a relaxed atomic add,
+ * and each thread's counters sit on their own cache line; histograms come
+ * from the trace thread's aggregates.  A scrape therefore never takes a lock
+ * the drawing thread uses.
+ */
+
+typedef struct {
+  // drawing thread
+  uint64_t slices_drawn __attribute__((aligned(CACHE_LINE_SIZE)));
+  uint64_t slices_dropped;     // not drawn before the next rotation began
+  uint64_t deadline_misses;    // drawn, but finished after the slice end time
+  uint64_t slices_limited;     // scaled down to max_amps
+  uint64_t rotations_limited;  // scaled down to max_average_amps
+  uint64_t columns_composited; // panel columns recomposed with overlay layers
+
+  // timing thread
+  uint64_t rotations __attribute__((aligned(CACHE_LINE_SIZE)));
+
+  // server thread
+  uint64_t panels_received __attribute__((aligned(CACHE_LINE_SIZE)));
+  uint64_t bytes_received;
+  uint64_t connections;
+} metrics_t;
+
+
+extern metrics_t metrics;
+
+
+static inline void metrics_add(uint64_t *counter, uint64_t n) {
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t metrics_get(uint64_t *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+
+extern void metrics_init();
+extern void *metrics_func();
+
+
+#endif
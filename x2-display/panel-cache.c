@@ -0,0 +1,126 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "constants.h"
+#include "drawing.h"
+#include "err.h"
+#include "geometry.h"
+#include "panel-cache.h"
+#include "x2-server.h"
+
+
+#define DEFAULT_PANEL_CACHE_MB 16
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+
+typedef struct {
+  uint64_t id;
+  uint64_t last_used;  // use_clock when last stored or shown, 0 if free
+  uint8_t *panel;
+  uint32_t len;  // as stored, before padding to a panel
+} cache_entry_t;
+
+
+cache_entry_t *cache_entries;
+unsigned int num_cache_entries;
+uint64_t use_clock = 0;
+
+
+void panel_cache_init() {
+  unsigned int budget_mb = config_int("panel_cache_mb", DEFAULT_PANEL_CACHE_MB);
+  num_cache_entries = ((uint64_t) budget_mb << 20) / geometry.panel_size;
+  if (num_cache_entries == 0)
+    return;
+
+  // panels are allocated as they are first needed, up to the budget
+  cache_entries = calloc(num_cache_entries, sizeof(cache_entry_t));
+  if (cache_entries == NULL)
+    error("ERROR allocating panel cache");
+
+  printf("Panel cache holds %u panels\n", num_cache_entries);
+}
+
+uint64_t panel_hash(const uint8_t *data, uint32_t len) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (uint32_t i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+cache_entry_t *find_entry(uint64_t id) {
+  for (unsigned int i = 0; i < num_cache_entries; i++)
+    if (cache_entries[i].last_used && cache_entries[i].id == id)
+      return &cache_entries[i];
+  return NULL;
+}
+
+/*
+ * Find an entry to reuse: a free one, or else the least recently used one
+ * that the drawing thread is not using and cannot start to.  Called with
+ * lock held, since that is what keeps draw_panel and to_draw_panel still.
+ */
+cache_entry_t *evict_entry() {
+  cache_entry_t *victim = NULL;
+  for (unsigned int i = 0; i < num_cache_entries; i++) {
+    cache_entry_t *entry = &cache_entries[i];
+    if (entry->last_used == 0)
+      return entry;
+    if (entry->panel == draw_panel || entry->panel == to_draw_panel)
+      continue;
+    if (victim == NULL || entry->last_used < victim->last_used)
+      victim = entry;
+  }
+  return victim;
+}
+
+bool panel_cache_store(const uint8_t *data, uint32_t len, uint64_t *id) {
+  *id = panel_hash(data, len);
+
+  cache_entry_t *entry = find_entry(*id);
+  if (entry != NULL) {
+    entry->last_used = ++use_clock;
+    return true;
+  }
+
+  pthread_mutex_lock(&lock);
+  entry = evict_entry();
+  if (entry != NULL)
+    entry->last_used = 0;
+  pthread_mutex_unlock(&lock);
+  if (entry == NULL)
+    return false;
+
+  if (entry->panel == NULL &&
+      posix_memalign((void **) &entry->panel, CACHE_LINE_SIZE, geometry.panel_size) != 0)
+    error("ERROR allocating cached panel");
+  memcpy(entry->panel, data, len);
+  memset(entry->panel + len, 0, geometry.panel_size - len);
+  entry->id = *id;
+  entry->len = len;
+  entry->last_used = ++use_clock;
+  return true;
+}
+
+// the cached panel with id, or NULL, and if len is not NULL its length as stored
+const uint8_t *panel_cache_panel(uint64_t id, uint32_t *len) {
+  cache_entry_t *entry = find_entry(id);
+  if (entry != NULL && len != NULL)
+    *len = entry->len;
+  return entry ? entry->panel : NULL;
+}
+
+bool panel_cache_show(uint64_t id) {
+  cache_entry_t *entry = find_entry(id);
+  if (entry == NULL)
+    return false;
+
+  entry->last_used = ++use_clock;
+  show_panel(entry->panel);
+  return true;
+}
@@ -0,0 +1,24 @@
+#ifndef _panel_cache_h_
+#define _panel_cache_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+
+/*
+ * Server-side cache of panels, keyed by the 64 bit FNV-1a hash of their
+ * content, so that content a client shows repeatedly is uploaded once and
+ * then recalled by id.  The least recently used panels are evicted to stay
+ * within panel_cache_mb, never the one being drawn or about to be.
+ *
+ * Only the server thread may call these.
+ */
+
+extern void panel_cache_init();
+extern uint64_t panel_hash(const uint8_t *data, uint32_t len);
+extern bool panel_cache_store(const uint8_t *data, uint32_t len, uint64_t *id);
+extern const uint8_t *panel_cache_panel(uint64_t id, uint32_t *len);
+extern bool panel_cache_show(uint64_t id);
+
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * Plays an animation file (see animation.h) on the sphere without a render
+ * host.  The file is memory mapped: raw frames are handed to the drawing
+ * thread as pointers into the mapping, and only run-length encoded frames
+ * are decoded, into buffers of the playback thread's own.  Pages are
+ * requested a few frames ahead and dropped again a few frames behind, so the
+ * resident set stays a handful of frames however long the animation is.
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "animation.h"
+#include "constants.h"
+#include "drawing.h"
+#include "err.h"
+#include "geometry.h"
+#include "playback.h"
+#include "realtime.h"
+#include "x2-server.h"
+
+
+#define READAHEAD_FRAMES 8
+#define RELEASE_BEHIND_FRAMES 16  // well behind the drawn panel, which may lag by a rotation
+#define MAX_SLEEP_NSEC (100 * 1000 * 1000)  // to notice shutdown
+
+
+// externs
+bool playing = false;
+
+
+uint8_t *map;
+size_t map_size;
+const animation_header_t *header;
+const animation_frame_t *frames;
+uint8_t *decode_panels[3];
+long page_size;
+
+
+void playback_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    error("ERROR opening animation file");
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    error("ERROR reading animation file");
+  map_size = st.st_size;
+  if (map_size < sizeof(animation_header_t)) {
+    fprintf(stderr, "%s: not an animation file\n", path);
+    exit(1);
+  }
+
+  map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    error("ERROR mapping animation file");
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  madvise(map, map_size, MADV_SEQUENTIAL);
+  close(fd);
+  page_size = sysconf(_SC_PAGESIZE);
+
+  header = (const animation_header_t *) map;
+  if (memcmp(header->magic, ANIMATION_MAGIC, 4) != 0 || header->version != ANIMATION_VERSION) {
+    fprintf(stderr, "%s: not an animation file, or a newer version\n", path);
+    exit(1);
+  }
+  if (header->width != geometry.panel_width || header->height != geometry.panel_height) {
+    fprintf(stderr, "%s: %" PRIu32 "x%" PRIu32 " frames, but panels are %ux%u\n", path,
+        header->width, header->height, geometry.panel_width, geometry.panel_height);
+    exit(1);
+  }
+  if (header->num_frames == 0 ||
+      sizeof(animation_header_t) + (uint64_t) header->num_frames * sizeof(animation_frame_t) > map_size) {
+    fprintf(stderr, "%s: bad frame index\n", path);
+    exit(1);
+  }
+
+  frames = (const animation_frame_t *) (map + sizeof(animation_header_t));
+  uint64_t duration_usec = 0;
+  for (uint32_t i = 0; i < header->num_frames; i++) {
+    if (frames[i].offset > map_size || frames[i].length > map_size - frames[i].offset) {
+      fprintf(stderr, "%s: frame %" PRIu32 " is past the end of the file\n", path, i);
+      exit(1);
+    }
+    // raw frames are drawn in place, and read a pixel at a time
+    if (frames[i].length == geometry.panel_size && frames[i].offset % PIXEL_SIZE != 0) {
+      fprintf(stderr, "%s: raw frame %" PRIu32 " is not aligned\n", path, i);
+      exit(1);
+    }
+    duration_usec += frames[i].duration_usec;
+  }
+  if (duration_usec == 0) {
+    fprintf(stderr, "%s: frames take no time\n", path);
+    exit(1);
+  }
+
+  for (int i = 0; i < 3; i++) {
+    if (posix_memalign((void **) &decode_panels[i], CACHE_LINE_SIZE, geometry.panel_size) != 0)
+      error("ERROR allocating playback panels");
+  }
+
+  printf("Playing %s, %" PRIu32 " frames\n", path, header->num_frames);
+  playing = true;
+}
+
+// apply advice to the pages holding a frame; in real-time mode the pages
+// read ahead are also locked, so that drawing them never faults, until they
+// are dropped
+void advise_frame(uint32_t frame_idx, int advice) {
+  const animation_frame_t *frame = &frames[frame_idx % header->num_frames];
+  uint64_t start = frame->offset & ~(uint64_t) (page_size - 1);
+  size_t len = frame->offset + frame->length - start;
+  if (realtime && advice == MADV_DONTNEED)
+    munlock(map + start, len);
+  madvise(map + start, len, advice);
+  if (realtime && advice == MADV_WILLNEED)
+    mlock(map + start, len);
+}
+
+bool rle_decode(uint8_t *panel, size_t size, const uint8_t *data, size_t len) {
+  size_t in = 0;
+  size_t out = 0;
+
+  while (in < len) {
+    unsigned int c = data[in++];
+    size_t n = c < RLE_MAX_LITERAL ? (c + 1) * PIXEL_SIZE : (c - 126) * PIXEL_SIZE;
+    size_t used = c < RLE_MAX_LITERAL ? n : PIXEL_SIZE;
+    if (in + used > len || out + n > size)
+      return false;
+
+    if (c < RLE_MAX_LITERAL) {
+      memcpy(panel + out, data + in, n);
+    } else {
+      for (size_t i = 0; i < n; i += PIXEL_SIZE)
+        memcpy(panel + out + i, data + in, PIXEL_SIZE);
+    }
+    in += used;
+    out += n;
+  }
+
+  return out == size;
+}
+
+/*
+ * The panel for a frame: raw frames straight from the mapping, encoded ones
+ * decoded into a buffer that is neither drawn nor about to be.  Returns NULL
+ * for a frame that does not decode.
+ */
+const uint8_t *frame_panel(uint32_t frame_idx) {
+  const animation_frame_t *frame = &frames[frame_idx];
+  const uint8_t *data = map + frame->offset;
+  if (frame->length == geometry.panel_size)
+    return data;
+
+  uint8_t *panel = unused_panel(decode_panels);
+  if (!rle_decode(panel, geometry.panel_size, data, frame->length))
+    return NULL;
+  return panel;
+}
+
+void add_nsec(struct timespec *ts, uint64_t nsec) {
+  nsec += ts->tv_nsec;
+  ts->tv_sec += nsec / NSEC_PER_SECOND;
+  ts->tv_nsec = nsec % NSEC_PER_SECOND;
+}
+
+// sleep until deadline, waking now and then to notice shutdown
+void sleep_until(const struct timespec *deadline) {
+  while (keepalive) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t left = (int64_t) (deadline->tv_sec - now.tv_sec) * NSEC_PER_SECOND + (deadline->tv_nsec - now.tv_nsec);
+    if (left <= 0)
+      return;
+    if (left <= MAX_SLEEP_NSEC) {
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
+      return;
+    }
+    struct timespec wake = now;
+    add_nsec(&wake, MAX_SLEEP_NSEC);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+  }
+}
+
+void *playback_func() {
+  if (!playing)
+    return NULL;
+
+  // mlockall() would otherwise keep every frame played in RAM
+  if (realtime)
+    munlock(map, map_size);
+
+  uint32_t num_frames = header->num_frames;
+  for (uint32_t i = 0; i < READAHEAD_FRAMES && i < num_frames; i++)
+    advise_frame(i, MADV_WILLNEED);
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  uint32_t frame_idx = 0;
+  while (keepalive) {
+    // prepare the frame before it is due, then show it on time
+    const uint8_t *panel = frame_panel(frame_idx);
+    sleep_until(&deadline);
+    if (panel != NULL)
+      show_panel(panel);
+    else
+      fprintf(stderr, "Animation frame %" PRIu32 " is corrupt, skipped\n", frame_idx);
+
+    // keep the pages of the next few frames coming, and let go of old ones
+    advise_frame(frame_idx + READAHEAD_FRAMES, MADV_WILLNEED);
+    if (num_frames > RELEASE_BEHIND_FRAMES + READAHEAD_FRAMES)
+      advise_frame(frame_idx + num_frames - RELEASE_BEHIND_FRAMES, MADV_DONTNEED);
+
+    add_nsec(&deadline, (uint64_t) frames[frame_idx].duration_usec * 1000);
+    frame_idx = (frame_idx + 1) % num_frames;
+  }
+
+  printf("Exiting playback thread\n");
+  return NULL;
+}
+
+// only once the drawing thread is done with the mapped frames
+void playback_close() {
+  if (!playing)
+    return;
+  munmap(map, map_size);
+  for (int i = 0; i < 3; i++)
+    free(decode_panels[i]);
+  playing = false;
+}
@@ -0,0 +1,15 @@
+#ifndef _playback_h_
+#define _playback_h_
+
+#include <stdbool.h>
+
+
+extern bool playing;
+
+
+extern void playback_open(const char *path);
+extern void *playback_func();
+extern void playback_close();
+
+
+#endif
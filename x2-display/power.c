@@ -0,0 +1,133 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "geometry.h"
+#include "metrics.h"
+#include "power.h"
+
+
+#define DEFAULT_CHANNEL_MA 20.0  // WS281x at full brightness
+#define DEFAULT_IDLE_MA 1.0      // per LED, when dark
+#define FULL_SCALE 256
+
+
+// externs
+double average_amps = 0;
+
+
+bool limiting;
+double channel_ma;
+double idle_ma;   // all the LEDs, dark
+double max_ma;
+double max_average_ma;
+
+unsigned int rotation_scale = FULL_SCALE;  // out of FULL_SCALE, for every slice this rotation
+uint64_t rotation_sum;  // channel values rendered this rotation, before limiting
+uint64_t rotation_scaled_sum;  // and after
+
+
+void power_init() {
+  max_ma = config_double("max_amps", 0) * 1000;
+  max_average_ma = config_double("max_average_amps", 0) * 1000;
+  channel_ma = config_double("channel_ma", DEFAULT_CHANNEL_MA);
+  idle_ma = config_double("idle_ma", DEFAULT_IDLE_MA) * geometry.num_strips * geometry.pixels_per_strip;
+  limiting = max_ma > 0 || max_average_ma > 0;
+
+  // the idle current cannot be scaled away
+  if ((max_ma > 0 && max_ma <= idle_ma) || (max_average_ma > 0 && max_average_ma <= idle_ma)) {
+    fprintf(stderr, "max_amps and max_average_amps must be above the idle %.2f A\n", idle_ma / 1000);
+    exit(1);
+  }
+  if (max_ma > 0)
+    printf("Limiting current to %.1f A per slice\n", max_ma / 1000);
+  if (max_average_ma > 0)
+    printf("Limiting current to %.1f A averaged over a rotation\n", max_average_ma / 1000);
+}
+
+/*
+ * Sum the channel values of a frame, a word (one pixel) at a time: blue and
+ * green accumulate in the two 16 bit halves and red is added to the low
+ * half, skipping the unused byte, so 128 pixels fit before folding.
+ */
+uint32_t frame_sum(const ledscape_frame_t *frame, unsigned int num_pixels) {
+  const uint8_t *p = (const uint8_t *) frame;
+  uint32_t sum = 0;
+
+  while (num_pixels > 0) {
+    unsigned int n = num_pixels < 128 ? num_pixels : 128;
+    uint32_t acc = 0;
+    for (unsigned int i = 0; i < n; i++, p += sizeof(uint32_t)) {
+      uint32_t w;
+      memcpy(&w, p, sizeof(w));
+      acc += (w & 0x00ff00ff) + ((w >> 8) & 0xff);
+    }
+    sum += (acc & 0xffff) + (acc >> 16);
+    num_pixels -= n;
+  }
+  return sum;
+}
+
+// multiply every byte of a frame by scale / FULL_SCALE, two bytes per multiply
+void frame_scale(ledscape_frame_t *frame, unsigned int num_pixels, uint32_t scale) {
+  uint8_t *p = (uint8_t *) frame;
+  for (unsigned int i = 0; i < num_pixels; i++, p += sizeof(uint32_t)) {
+    uint32_t w;
+    memcpy(&w, p, sizeof(w));
+    w = ((((w & 0x00ff00ff) * scale) >> 8) & 0x00ff00ff) | ((((w >> 8) & 0x00ff00ff) * scale) & 0xff00ff00);
+    memcpy(p, &w, sizeof(w));
+  }
+}
+
+double estimate_ma(uint64_t sum) {
+  return idle_ma + sum * channel_ma / 255;
+}
+
+/*
+ * Start a rotation: if the last one averaged over the budget, scale this one
+ * down to it, and otherwise let it back up.
+ */
+void power_rotation(unsigned int slices_drawn) {
+  if (!limiting || slices_drawn == 0)
+    return;
+
+  average_amps = estimate_ma(rotation_scaled_sum / slices_drawn) / 1000;
+  rotation_scale = FULL_SCALE;
+  if (max_average_ma > 0) {
+    double ma = estimate_ma(rotation_sum / slices_drawn);
+    if (ma > max_average_ma) {
+      double allowed = FULL_SCALE * (max_average_ma - idle_ma) / (ma - idle_ma);
+      rotation_scale = allowed > 0 ? (allowed < FULL_SCALE ? allowed : FULL_SCALE) : 0;
+      metrics_add(&metrics.rotations_limited, 1);
+    }
+  }
+
+  rotation_sum = 0;
+  rotation_scaled_sum = 0;
+}
+
+// scale a rendered slice down to the budget
+void power_limit(ledscape_frame_t *frame) {
+  if (!limiting)
+    return;
+
+  const unsigned int num_pixels = LEDSCAPE_NUM_STRIPS * geometry.pixels_per_strip;
+  uint32_t sum = frame_sum(frame, num_pixels);
+  rotation_sum += sum;
+
+  unsigned int scale = rotation_scale;
+  if (max_ma > 0 && estimate_ma((uint64_t) sum * scale / FULL_SCALE) > max_ma) {
+    double dynamic_ma = estimate_ma(sum) - idle_ma;
+    double allowed = FULL_SCALE * (max_ma - idle_ma) / dynamic_ma;
+    scale = allowed > 0 ? (allowed < FULL_SCALE ? allowed : FULL_SCALE) : 0;
+    metrics_add(&metrics.slices_limited, 1);
+  }
+
+  if (scale < FULL_SCALE) {
+    frame_scale(frame, num_pixels, scale);
+    sum = (uint64_t) sum * scale / FULL_SCALE;
+  }
+  rotation_scaled_sum += sum;
+}
@@ -0,0 +1,25 @@
+#ifndef _power_h_
+#define _power_h_
+
+#include "ledscape.h"
+
+
+/*
+ * Current limiting, so that bright content cannot sag the supply through
+ * the slip ring and reset the LEDs or the BeagleBone.
+ *
+ * Each rendered slice's current is estimated from the sum of its channel
+ * values.  A slice over max_amps is scaled down to it, and a rotation
+ * whose average was over max_average_amps scales the next one down to that,
+ * so that brief peaks are cut without darkening everything else.
+ */
+
+extern double average_amps;  // estimated for the last rotation, after limiting
+
+
+extern void power_init();
+extern void power_rotation(unsigned int slices_drawn);
+extern void power_limit(ledscape_frame_t *frame);
+
+
+#endif
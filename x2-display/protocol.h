@@ -0,0 +1,179 @@
+#ifndef _protocol_h_
+#define _protocol_h_
+
+#include <inttypes.h>
+#include <string.h>
+
+
+/*
+ * Framed x2-display protocol, version 1.
+ *
+ * A connection that starts with 'X' is framed; any other first byte is a
+ * legacy single-command connection ('0' panel, '?' stats, 'x', 'b', 'c').
+ * All fields are little-endian.
+ *
+ * The client opens with a hello: "X2PR", u16 version, u16 reserved (0).  The
+ * server answers with a hello carrying the version it will speak, the lower
+ * of the two, or closes the connection if it cannot speak it.
+ *
+ * Then both sides send messages: a header of u32 payload length, u16 type
+ * and u16 sequence number, followed by the payload.  Requests may be
+ * pipelined; the server handles them in order and answers every request with
+ * exactly one reply carrying the same sequence number, of type
+ * (type | X2_MSG_REPLY) or X2_MSG_ERROR with a text payload.
+ *
+ *   X2_MSG_PING        any payload, echoed back
+ *   X2_MSG_PANEL       BRGA panel, at most the panel size, zero padded;
+ *                      empty reply
+ *   X2_MSG_X_OFFSET    u32, replies with the u32 in effect
+ *   X2_MSG_BRIGHTNESS  f32, replies with the f32 in effect
+ *   X2_MSG_CONTRAST    f32, replies with the f32 in effect
+ *   X2_MSG_PANEL_STORE BRGA panel as for X2_MSG_PANEL, kept in the panel
+ *                      cache without showing it; replies with its u64 id,
+ *                      the 64 bit FNV-1a hash of the payload, so clients
+ *                      can also compute ids themselves
+ *   X2_MSG_PANEL_SHOW  u64 id of a cached panel to show; empty reply, or an
+ *                      error if it is not (or no longer) cached
+ *   X2_MSG_IMAGE       u8 projection (0 equirectangular, 1 cubemap), 3 bytes
+ *                      reserved, u32 width, u32 height, then width * height
+ *                      RGB pixels, resampled by the server to a panel and
+ *                      shown; empty reply.  Equirectangular images span
+ *                      longitude 0 to 360 degrees left to right and north to
+ *                      south; cubemaps stack six width x width faces, +X, -X,
+ *                      +Y, -Y, +Z, -Z, with Y up and longitude 0 along +X
+ *   X2_MSG_EFFECT      NUL terminated effect name of at most 15 bytes,
+ *                      then up to 8 f32 parameters (see effects.c); starts
+ *                      the effect, or retunes it if it is running, or stops
+ *                      effects if the name is empty.  Empty reply, or an
+ *                      error if there is no such effect
+ *   X2_MSG_LAYER       u8 layer (0 to 7), 3 bytes reserved, f32 longitude
+ *                      and f32 latitude in degrees of its top left corner,
+ *                      u16 width, u16 height, then width * height pixels
+ *                      as in a panel but with the unused byte as alpha (0
+ *                      transparent to 255 opaque); overlays the layer on
+ *                      whatever panel is shown, above lower numbered
+ *                      layers, or removes it if width or height is 0.
+ *                      Empty reply
+ *   X2_MSG_LAYER_MOVE  u8 layer, 3 bytes reserved, f32 longitude, f32
+ *                      latitude; moves the layer.  Empty reply, or an error
+ *                      if the layer is not set
+ *   X2_MSG_LAYER_SCROLL u8 layer, 3 bytes reserved, f32 degrees per second;
+ *                      scrolls the layer's pixels through the columns it
+ *                      covers, towards higher longitudes if positive.
+ *                      Empty reply, or an error if the layer is not set
+ *   X2_MSG_TEXT        u8 layer, u8 scale (1 to 8), 2 bytes reserved, f32
+ *                      longitude and f32 latitude of the top left corner,
+ *                      f32 width in degrees (0 to fit the text), f32
+ *                      scroll speed as for X2_MSG_LAYER_SCROLL, text
+ *                      colour and background colour as alpha, red, green,
+ *                      blue bytes, then the ASCII text; rasterizes the text
+ *                      into the layer, 7 * scale rows high and 6 * scale
+ *                      columns per character.  Empty reply
+ *   X2_MSG_SPIN        f32 velocity in degrees per second and f32
+ *                      acceleration in degrees per second per second, NaN
+ *                      to keep either; spins the panel around the axis,
+ *                      blending between columns, from the next rotation.
+ *                      Replies with the two f32 in effect
+ *   X2_MSG_STATS       empty, replies with X2_STATS_SIZE bytes:
+ *                        f64 rotations per second
+ *                        f64 panels per second
+ *                        u32 slices per rotation
+ *                        u32 slice time budget, usec
+ *                        u64 PRU frames since startup
+ *                        u64 PRU overrun bits since startup
+ *                        u32[4][3] p50, p99 and p100 usec of the PRU load,
+ *                                  clock, reset and whole transfer
+ *                        u64 panels received since startup
+ *                        u64 slice deadline misses since startup
+ *
+ * A message longer than the largest the server accepts closes the connection.
+ */
+
+#define X2_PROTOCOL_MAGIC "X2PR"
+#define X2_PROTOCOL_VERSION 1
+
+#define X2_HELLO_SIZE 8
+#define X2_HEADER_SIZE 8
+#define X2_MAX_SMALL_PAYLOAD 4096  // everything but panels and images
+#define X2_IMAGE_HEADER_SIZE 12
+#define X2_LAYER_HEADER_SIZE 16
+#define X2_LAYER_MOVE_SIZE 12
+#define X2_LAYER_SCROLL_SIZE 8
+#define X2_TEXT_HEADER_SIZE 28
+
+#define X2_MSG_PING 1
+#define X2_MSG_PANEL 2
+#define X2_MSG_X_OFFSET 3
+#define X2_MSG_BRIGHTNESS 4
+#define X2_MSG_CONTRAST 5
+#define X2_MSG_STATS 6
+#define X2_MSG_PANEL_STORE 7
+#define X2_MSG_PANEL_SHOW 8
+#define X2_MSG_IMAGE 9
+#define X2_MSG_EFFECT 10
+#define X2_MSG_LAYER 11
+#define X2_MSG_LAYER_MOVE 12
+#define X2_MSG_LAYER_SCROLL 13
+#define X2_MSG_TEXT 14
+#define X2_MSG_SPIN 15
+#define X2_MSG_REPLY 0x8000
+#define X2_MSG_ERROR 0xffff
+
+#define X2_STATS_SIZE (2 * 8 + 2 * 4 + 2 * 8 + 12 * 4 + 2 * 8)
+
+
+static inline void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+  put_u16(p, v);
+  put_u16(p + 2, v >> 16);
+}
+
+static inline void put_u64(uint8_t *p, uint64_t v) {
+  put_u32(p, v);
+  put_u32(p + 4, v >> 32);
+}
+
+static inline void put_f32(uint8_t *p, float v) {
+  uint32_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  put_u32(p, bits);
+}
+
+static inline void put_f64(uint8_t *p, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  put_u64(p, bits);
+}
+
+static inline uint16_t get_u16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_u32(const uint8_t *p) {
+  return get_u16(p) | ((uint32_t) get_u16(p + 2) << 16);
+}
+
+static inline uint64_t get_u64(const uint8_t *p) {
+  return get_u32(p) | ((uint64_t) get_u32(p + 4) << 32);
+}
+
+static inline float get_f32(const uint8_t *p) {
+  uint32_t bits = get_u32(p);
+  float v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+static inline double get_f64(const uint8_t *p) {
+  uint64_t bits = get_u64(p);
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+
+#endif
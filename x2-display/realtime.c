@@ -0,0 +1,214 @@
+#define _GNU_SOURCE  // CPU affinity and the default thread attributes
+
+#include <inttypes.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "config.h"
+#include "constants.h"
+#include "drawing.h"
+#include "geometry.h"
+#include "realtime.h"
+
+
+#define THREAD_STACK_SIZE (256 * 1024)  // locked in full, so not the default 8 MB
+#define PAGE_SIZE 4096
+#define DEFAULT_TEST_SECONDS 2
+#define DEFAULT_NOMINAL_RPS 10
+#define TEST_PERIOD_USEC 1000
+#define LOAD_BUFFER_SIZE (4 * 1024 * 1024)
+
+
+typedef struct {
+  const char *name;
+  int priority;
+  bool spins;  // busy-waits, so would starve every other thread of a single CPU
+} thread_default_t;
+
+// the timing thread stamps the hall sensor, so it comes first
+const thread_default_t thread_defaults[] = {
+  { "timing", 90, false },
+  { "drawing", 80, true },
+};
+
+
+bool realtime;
+
+volatile bool loading;  // load threads run until cleared
+unsigned int num_samples;
+
+
+uint64_t now_usec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * USEC_PER_SECOND + ts.tv_nsec / 1000;
+}
+
+// touch every page, so that none faults in the slice loop
+void prefault(volatile uint8_t *p, size_t len) {
+  for (size_t i = 0; i < len; i += PAGE_SIZE)
+    p[i] = p[i];
+}
+
+void realtime_init() {
+  realtime = config_int("realtime", 0);
+  if (!realtime)
+    return;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+  if (pthread_setattr_default_np(&attr) != 0)
+    fprintf(stderr, "Cannot set the default thread stack size\n");
+  pthread_attr_destroy(&attr);
+
+  // locking pages only as they are faulted in leaves the animation mapping,
+  // which playback locks a few frames at a time, out of RAM until needed
+  if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) != 0 && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    perror("WARNING mlockall, pages may fault in the slice loop");
+
+  for (int i = 0; i < 3; i++)
+    prefault(panels[i], geometry.panel_size);
+  for (int i = 0; i < 2; i++)
+    prefault((volatile uint8_t *) ledscape_frame(leds, i), geometry.frame_size);
+
+  printf("Real-time mode: memory locked\n");
+}
+
+// apply a thread's configured priority and CPU, warning of failures
+void apply_settings(pthread_t thread, const char *name, int *priority, int *cpu) {
+  int default_priority = 0;
+  for (unsigned int i = 0; i < sizeof(thread_defaults) / sizeof(*thread_defaults); i++)
+    if (strcmp(thread_defaults[i].name, name) == 0 &&
+        (!thread_defaults[i].spins || sysconf(_SC_NPROCESSORS_ONLN) > 1))
+      default_priority = thread_defaults[i].priority;
+
+  char key[64];
+  snprintf(key, sizeof(key), "%s_priority", name);
+  *priority = config_int(key, default_priority);
+  snprintf(key, sizeof(key), "%s_cpu", name);
+  *cpu = config_int(key, -1);
+
+  if (*priority > 0) {
+    struct sched_param param = { .sched_priority = *priority };
+    int rc = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    if (rc != 0) {
+      fprintf(stderr, "WARNING %s thread: SCHED_FIFO priority %d: %s\n", name, *priority, strerror(rc));
+      *priority = 0;
+    }
+  }
+
+  if (*cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(*cpu, &cpus);
+    int rc = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+    if (rc != 0) {
+      fprintf(stderr, "WARNING %s thread: CPU %d: %s\n", name, *cpu, strerror(rc));
+      *cpu = -1;
+    }
+  }
+}
+
+/*
+ * Give a thread its configured priority and CPU.  Failures, such as not
+ * running as root, are reported and leave the thread as it was.
+ */
+void realtime_thread(pthread_t thread, const char *name) {
+  if (!realtime)
+    return;
+
+  int priority, cpu;
+  apply_settings(thread, name, &priority, &cpu);
+  char where[32] = "";
+  if (cpu >= 0)
+    snprintf(where, sizeof(where), " on CPU %d", cpu);
+  if (priority > 0)
+    printf("%s thread: SCHED_FIFO priority %d%s\n", name, priority, where);
+  else
+    printf("%s thread: default scheduling%s\n", name, where);
+}
+
+// keep a CPU and the memory bus busy at normal priority
+void *load_func() {
+  uint8_t *buf = malloc(LOAD_BUFFER_SIZE);
+  if (buf == NULL)
+    return NULL;
+  unsigned int n = 0;
+  while (loading) {
+    for (size_t i = 0; i < LOAD_BUFFER_SIZE && loading; i += CACHE_LINE_SIZE)
+      buf[i] = n++;
+  }
+  free(buf);
+  return NULL;
+}
+
+int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+// sleep to the next millisecond over and over, recording how late each wake is
+void *latency_func(void *arg) {
+  uint32_t *latencies = arg;
+  uint64_t target_usec = now_usec();
+  for (unsigned int i = 0; i < num_samples; i++) {
+    target_usec += TEST_PERIOD_USEC;
+    struct timespec ts = { .tv_sec = target_usec / USEC_PER_SECOND, .tv_nsec = (target_usec % USEC_PER_SECOND) * 1000 };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    latencies[i] = now_usec() - target_usec;
+  }
+  return NULL;
+}
+
+void realtime_selftest() {
+  if (!realtime)
+    return;
+  double seconds = config_double("latency_test_seconds", DEFAULT_TEST_SECONDS);
+  double nominal_rps = config_double("nominal_rps", DEFAULT_NOMINAL_RPS);
+  num_samples = seconds * USEC_PER_SECOND / TEST_PERIOD_USEC;
+  if (num_samples == 0)
+    return;
+
+  uint32_t *latencies = malloc(num_samples * sizeof(uint32_t));
+  if (latencies == NULL)
+    return;
+
+  // a load thread per CPU, then the test at the timing thread's settings
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_cpus < 1)
+    num_cpus = 1;
+  pthread_t load_threads[num_cpus];
+  loading = true;
+  for (long i = 0; i < num_cpus; i++)
+    pthread_create(&load_threads[i], NULL, load_func, NULL);
+
+  printf("Measuring wake-up latency under load for %.0f s\n", seconds);
+  pthread_t test_thread;
+  pthread_create(&test_thread, NULL, latency_func, latencies);
+  int priority, cpu;
+  apply_settings(test_thread, "timing", &priority, &cpu);
+  pthread_join(test_thread, NULL);
+
+  loading = false;
+  for (long i = 0; i < num_cpus; i++)
+    pthread_join(load_threads[i], NULL);
+
+  qsort(latencies, num_samples, sizeof(uint32_t), compare_u32);
+  uint32_t p99 = latencies[num_samples * 99 / 100];
+  uint32_t max = latencies[num_samples - 1];
+  printf("Wake-up latency usec: p50 %" PRIu32 ", p99 %" PRIu32 ", max %" PRIu32 "\n",
+      latencies[num_samples / 2], p99, max);
+
+  double slice_usec = USEC_PER_SECOND / (nominal_rps * geometry.num_slices);
+  if (max > slice_usec)
+    fprintf(stderr, "WARNING wake-up latency of up to %" PRIu32 " usec is more than a slice (%.0f usec at %.0f rps); "
+        "the image may tear or jitter\n", max, slice_usec, nominal_rps);
+  free(latencies);
+}
@@ -0,0 +1,30 @@
+#ifndef _realtime_h_
+#define _realtime_h_
+
+#include <pthread.h>
+#include <stdbool.h>
+
+
+/*
+ * Real-time mode, with the realtime setting on: memory is locked as it is
+ * faulted in, with the panels and frames faulted in up front, and each
+ * thread gets the scheduling policy and CPU set in the config as
+ * <name>_priority (SCHED_FIFO priority, or 0 for the default scheduler) and
+ * <name>_cpu (or -1 for any), so that the network, logging and everything
+ * else cannot preempt the timing and drawing threads.  Playback locks only
+ * the frames around the one playing.
+ *
+ * A self-test then measures timer wake-up latency at the timing thread's
+ * settings while every CPU is loaded, and warns if it could cost more than a
+ * slice at nominal_rps.
+ */
+
+extern bool realtime;
+
+
+extern void realtime_init();
+extern void realtime_thread(pthread_t thread, const char *name);
+extern void realtime_selftest();
+
+
+#endif
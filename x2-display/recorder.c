@@ -0,0 +1,65 @@
+/*
+ * Records every message the server receives, with its arrival time, so that
+ * x2-replay can play the same load back later.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "err.h"
+#include "geometry.h"
+#include "protocol.h"
+#include "recorder.h"
+#include "timing.h"
+
+
+#define RECORDER_BUFSIZE (1024 * 1024)
+
+
+// externs
+bool recording = false;
+
+
+FILE *recorder_file;
+char recorder_buf[RECORDER_BUFSIZE];
+uint64_t recorder_start_usec;
+
+
+void recorder_open(const char *path) {
+  recorder_file = fopen(path, "wb");
+  if (recorder_file == NULL)
+    error("ERROR opening recording file");
+  setvbuf(recorder_file, recorder_buf, _IOFBF, sizeof(recorder_buf));
+
+  recorder_header_t header = {
+    .magic = RECORDER_MAGIC,
+    .version = RECORDER_VERSION,
+    .protocol_version = X2_PROTOCOL_VERSION,
+    .panel_size = geometry.panel_size,
+  };
+  fwrite(&header, sizeof(header), 1, recorder_file);
+  recorder_start_usec = gettime();
+
+  printf("Recording session to %s\n", path);
+  recording = true;
+}
+
+void recorder_message(uint32_t connection, uint16_t type, uint16_t seq, const uint8_t *payload, uint32_t len) {
+  recorder_record_t record = {
+    .timestamp_usec = gettime() - recorder_start_usec,
+    .connection = connection,
+    .length = len,
+    .type = type,
+    .seq = seq,
+  };
+  fwrite(&record, sizeof(record), 1, recorder_file);
+  if (len > 0 && fwrite(payload, len, 1, recorder_file) != 1)
+    error("ERROR writing recording file");
+}
+
+void recorder_close() {
+  if (!recording)
+    return;
+  recording = false;
+  fclose(recorder_file);
+}
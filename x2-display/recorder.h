@@ -0,0 +1,45 @@
+#ifndef _recorder_h_
+#define _recorder_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+
+/*
+ * Session recording, for replay with x2-replay.
+ * All fields are little-endian (native on both the BBB and x86 hosts).
+ *
+ * A recorder_header_t, then one recorder_record_t per message received,
+ * each followed by its payload.  Legacy commands are recorded as the
+ * framed messages that do the same (see protocol.h), so every session
+ * replays over the framed protocol.
+ */
+
+#define RECORDER_MAGIC "X2RC"
+#define RECORDER_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t protocol_version;  // of the recorded message types
+  uint32_t panel_size;        // bytes in a full panel
+} __attribute__((__packed__)) recorder_header_t;
+
+typedef struct {
+  uint64_t timestamp_usec;  // arrival, since the recording started
+  uint32_t connection;      // distinguishes concurrent clients
+  uint32_t length;          // of the payload
+  uint16_t type;
+  uint16_t seq;
+} __attribute__((__packed__)) recorder_record_t;
+
+
+extern bool recording;
+
+
+extern void recorder_open(const char *path);
+extern void recorder_message(uint32_t connection, uint16_t type, uint16_t seq, const uint8_t *payload, uint32_t len);
+extern void recorder_close();
+
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * Slice render kernels.
+ *
+ * The kernel is written once, generic over the sphere geometry, and inlined
+ * into wrappers that fix the geometry of the spheres we have built at compile
+ * time, so that the compiler can unroll and strength-reduce the inner loops.
+ * render_init() picks the wrapper matching the configured geometry, or the
+ * generic kernel that reads it at runtime.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "calibration.h"
+#include "color.h"
+#include "drawing.h"
+#include "geometry.h"
+#include "render.h"
+#include "slice-filter.h"
+#include "strip-map.h"
+
+
+// externs
+render_func_t render_slice;
+
+
+static inline __attribute__((always_inline))
+void render_kernel(ledscape_frame_t *frame, const uint8_t *panel,
+    unsigned int slice_idx, unsigned int num_slices, unsigned int x_offset,
+    unsigned int rotation, const color_lut_t *lut, const led_calibration_t *cal,
+    const slice_taps_t *filter,
+    const unsigned int pixels_per_strip, const unsigned int num_strips,
+    const unsigned int num_arms, const unsigned int slices_per_arm) {
+  const unsigned int panel_width = num_arms * slices_per_arm;
+  const unsigned int num_rows = num_strips / num_arms;
+
+  // panel column under each arm, mirrored since the sphere turns backwards,
+  // or the columns it sweeps if filtering
+  unsigned int arm_x[MAX_ARMS];
+  const uint16_t *arm_dither[MAX_ARMS];
+  const slice_taps_t *arm_taps[MAX_ARMS];
+  unsigned int tap_x[MAX_ARMS][FILTER_MAX_TAPS];
+  for (unsigned int col = 0; col < num_arms; col++) {
+    unsigned int pos = (slice_idx + col * (num_slices / num_arms)) % num_slices;
+    unsigned int angle = (x_offset + pos * panel_width / num_slices) % panel_width;
+    arm_x[col] = panel_width - 1 - angle;
+    arm_dither[col] = dither_thresholds[(pos + rotation / 4) % 4];
+
+    if (filter) {
+      const slice_taps_t *t = &filter[pos];
+      arm_taps[col] = t;
+      for (unsigned int i = 0; i < t->num_taps; i++)
+        tap_x[col][i] = panel_width - 1 - (x_offset + t->first + i * t->stride) % panel_width;
+    }
+  }
+
+  for (unsigned int strip_idx = 0; strip_idx < num_strips; strip_idx++) {
+    unsigned int row = strip_idx / num_arms;
+    unsigned int col = (num_arms - strip_idx % num_arms) % num_arms;  // arm position around the axis
+    const uint8_t *column = panel + arm_x[col] * PIXEL_SIZE;
+
+    unsigned int y_offset = row * pixels_per_strip;
+    ledscape_pixel_t *out = &frame[0].strip[strip_map[strip_idx]];
+    const uint16_t *dither = arm_dither[col];
+    const led_calibration_t *led = cal + strip_idx * pixels_per_strip;
+    if (filter) {
+      const slice_taps_t *t = arm_taps[col];
+      for (unsigned int pixel_idx = 0; pixel_idx < pixels_per_strip; pixel_idx++) {
+        unsigned int y = y_offset + (row < num_rows / 2 ? pixel_idx : pixels_per_strip - 1 - pixel_idx);
+        const uint8_t *line = panel + y * panel_width * PIXEL_SIZE;
+
+        uint32_t r = 0, g = 0, b = 0;
+        for (unsigned int i = 0; i < t->num_taps; i++) {
+          const uint8_t *p = line + tap_x[col][i] * PIXEL_SIZE;
+          r += t->weights[i] * p[1];
+          g += t->weights[i] * p[2];
+          b += t->weights[i] * p[3];
+        }
+
+        // the sums are 8.8 fixed point; keep the fraction through the table
+        uint32_t threshold = dither[(pixel_idx + rotation) % 4];
+        out->r = color_round(calibrate(color_lerp(lut->r, r), led, 0), threshold);
+        out->g = color_round(calibrate(color_lerp(lut->g, g), led, 1), threshold);
+        out->b = color_round(calibrate(color_lerp(lut->b, b), led, 2), threshold);
+        out += LEDSCAPE_NUM_STRIPS;
+        led++;
+      }
+      continue;
+    }
+
+    for (unsigned int pixel_idx = 0; pixel_idx < pixels_per_strip; pixel_idx++) {
+      // invert pixel_idx for lower hemisphere
+      unsigned int y = y_offset + (row < num_rows / 2 ? pixel_idx : pixels_per_strip - 1 - pixel_idx);
+      const uint8_t *p = column + y * panel_width * PIXEL_SIZE;
+
+      uint32_t threshold = dither[(pixel_idx + rotation) % 4];
+      out->r = color_round(calibrate(lut->r[p[1]], led, 0), threshold);
+      out->g = color_round(calibrate(lut->g[p[2]], led, 1), threshold);
+      out->b = color_round(calibrate(lut->b[p[3]], led, 2), threshold);
+      out += LEDSCAPE_NUM_STRIPS;
+      led++;
+    }
+  }
+}
+
+void render_slice_generic(ledscape_frame_t *frame, const uint8_t *panel,
+    unsigned int slice_idx, unsigned int num_slices, unsigned int x_offset,
+    unsigned int rotation, const color_lut_t *lut, const led_calibration_t *cal,
+    const slice_taps_t *filter) {
+  render_kernel(frame, panel, slice_idx, num_slices, x_offset, rotation, lut, cal, filter,
+      geometry.pixels_per_strip, geometry.num_strips, geometry.num_arms, geometry.slices_per_arm);
+}
+
+// The original sphere: 24 strips of 17 pixels on 4 arms, 224 column panels
+void render_slice_17x24x4x56(ledscape_frame_t *frame, const uint8_t *panel,
+    unsigned int slice_idx, unsigned int num_slices, unsigned int x_offset,
+    unsigned int rotation, const color_lut_t *lut, const led_calibration_t *cal,
+    const slice_taps_t *filter) {
+  render_kernel(frame, panel, slice_idx, num_slices, x_offset, rotation, lut, cal, filter, 17, 24, 4, 56);
+}
+
+// The same sphere with double the horizontal panel resolution
+void render_slice_17x24x4x112(ledscape_frame_t *frame, const uint8_t *panel,
+    unsigned int slice_idx, unsigned int num_slices, unsigned int x_offset,
+    unsigned int rotation, const color_lut_t *lut, const led_calibration_t *cal,
+    const slice_taps_t *filter) {
+  render_kernel(frame, panel, slice_idx, num_slices, x_offset, rotation, lut, cal, filter, 17, 24, 4, 112);
+}
+
+
+typedef struct {
+  unsigned int pixels_per_strip;
+  unsigned int num_strips;
+  unsigned int num_arms;
+  unsigned int slices_per_arm;
+  render_func_t func;
+  const char *name;
+} render_kernel_t;
+
+const render_kernel_t render_kernels[] = {
+  { 17, 24, 4, 56, render_slice_17x24x4x56, "17x24x4x56" },
+  { 17, 24, 4, 112, render_slice_17x24x4x112, "17x24x4x112" },
+};
+
+
+void render_init() {
+  render_slice = render_slice_generic;
+  const char *name = "generic";
+
+  for (unsigned int i = 0; i < sizeof(render_kernels) / sizeof(*render_kernels); i++) {
+    const render_kernel_t *k = &render_kernels[i];
+    if (k->pixels_per_strip == geometry.pixels_per_strip && k->num_strips == geometry.num_strips
+        && k->num_arms == geometry.num_arms && k->slices_per_arm == geometry.slices_per_arm) {
+      render_slice = k->func;
+      name = k->name;
+      break;
+    }
+  }
+
+  printf("Using %s render kernel\n", name);
+}
@@ -0,0 +1,33 @@
+#ifndef _render_h_
+#define _render_h_
+
+#include <inttypes.h>
+#include "calibration.h"
+#include "color.h"
+#include "ledscape.h"
+#include "slice-filter.h"
+
+
+/*
+ * Render slice slice_idx of num_slices in this rotation into a ledscape frame.
+ * num_slices need not match the panel width, but must be a multiple of the
+ * arm count; the panel is resampled to it.  x_offset rotates the panel around
+ * the axis, in panel columns.  rotation counts rotations, to move the
+ * dither pattern.  lut is the colour correction from color_lut() and cal the
+ * per-LED calibration from calibration().  filter, if not NULL, is the table
+ * from slice_filter() for num_slices, to average the columns each slice
+ * sweeps.
+ */
+typedef void (*render_func_t)(ledscape_frame_t *frame, const uint8_t *panel,
+    unsigned int slice_idx, unsigned int num_slices, unsigned int x_offset,
+    unsigned int rotation, const color_lut_t *lut, const led_calibration_t *cal,
+    const slice_taps_t *filter);
+
+
+extern render_func_t render_slice;
+
+
+extern void render_init();
+
+
+#endif
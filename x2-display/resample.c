@@ -0,0 +1,371 @@
+/*
+ * Image to panel resampling.
+ *
+ * Panel column x covers longitudes [x, x + 1) * 360 / panel_width, and panel
+ * row y an equal share of the latitudes from top_latitude down to
+ * bottom_latitude, where the LEDs of the arms are.  A panel pixel is the
+ * average of the image over that patch of the sphere, each part weighted by
+ * its area on the sphere, so that the many image pixels crowded together
+ * near the poles count for no more than they cover.
+ *
+ * Equirectangular images are resampled separably: every image row is first
+ * reduced to the panel width, then the rows are combined into panel rows.
+ * Cubemaps are sampled over each panel pixel's patch, as finely as the faces
+ * need, into a table of image pixels and weights per panel pixel.
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "config.h"
+#include "drawing.h"
+#include "err.h"
+#include "geometry.h"
+#include "resample.h"
+
+
+#define DEFAULT_MAX_IMAGE_MB 16
+#define MAX_THREADS 16
+#define MAX_SUPERSAMPLE 8  // per axis, for cubemaps
+#define RGB_SIZE 3
+#define DEG_TO_RAD (M_PI / 180)
+
+
+typedef struct {
+  uint32_t src;  // image pixel, column or row
+  float weight;
+} tap_t;
+
+typedef struct {
+  uint32_t start;
+  uint32_t count;
+} tap_span_t;
+
+typedef struct {
+  tap_span_t *spans;
+  tap_t *taps;
+  unsigned int num_taps;
+  unsigned int size_taps;
+} tap_table_t;
+
+// weights for the last image size and projection seen
+typedef struct {
+  bool valid;
+  unsigned int projection;
+  unsigned int width;
+  unsigned int height;
+  tap_table_t cols;    // equirect: image columns for each panel column
+  tap_table_t rows;    // equirect: image rows for each panel row
+  tap_table_t pixels;  // cubemap: image pixels for each panel pixel
+  float *reduced;      // equirect: image rows reduced to the panel width
+} weights_t;
+
+typedef struct {
+  void (*func)(unsigned int begin, unsigned int end);
+  unsigned int begin;
+  unsigned int end;
+} work_t;
+
+
+// externs
+uint32_t max_image_size;
+
+
+unsigned int num_threads;
+double top_latitude;
+double bottom_latitude;
+
+weights_t weights;
+
+// the image being resampled, for the workers
+const uint8_t *job_rgb;
+uint8_t *job_panel;
+
+
+void resample_init() {
+  max_image_size = (uint32_t) config_int("max_image_mb", DEFAULT_MAX_IMAGE_MB) << 20;
+  top_latitude = config_double("top_latitude", 90);
+  bottom_latitude = config_double("bottom_latitude", -90);
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  num_threads = config_int("resample_threads", cpus > 0 ? cpus : 1);
+  if (num_threads < 1)
+    num_threads = 1;
+  if (num_threads > MAX_THREADS)
+    num_threads = MAX_THREADS;
+}
+
+void add_tap(tap_table_t *table, uint32_t src, float weight) {
+  if (table->num_taps == table->size_taps) {
+    table->size_taps = table->size_taps ? 2 * table->size_taps : 1024;
+    table->taps = realloc(table->taps, table->size_taps * sizeof(tap_t));
+    if (table->taps == NULL)
+      error("ERROR allocating resample weights");
+  }
+  table->taps[table->num_taps].src = src;
+  table->taps[table->num_taps].weight = weight;
+  table->num_taps++;
+}
+
+void begin_span(tap_table_t *table, unsigned int i) {
+  table->spans[i].start = table->num_taps;
+  table->spans[i].count = 0;
+}
+
+// scale the taps of the span just built to sum to one
+void end_span(tap_table_t *table, unsigned int i) {
+  tap_span_t *span = &table->spans[i];
+  span->count = table->num_taps - span->start;
+
+  float sum = 0;
+  for (unsigned int t = 0; t < span->count; t++)
+    sum += table->taps[span->start + t].weight;
+  for (unsigned int t = 0; t < span->count; t++)
+    table->taps[span->start + t].weight = sum > 0 ? table->taps[span->start + t].weight / sum : 0;
+}
+
+void reset_table(tap_table_t *table, unsigned int num_spans) {
+  free(table->spans);
+  table->spans = calloc(num_spans, sizeof(tap_span_t));
+  if (table->spans == NULL)
+    error("ERROR allocating resample weights");
+  table->num_taps = 0;
+}
+
+// latitude in degrees of the top (edge 0) or bottom (edge 1) of a panel row
+double row_latitude(unsigned int y, unsigned int edge) {
+  return top_latitude - (y + edge) * (top_latitude - bottom_latitude) / geometry.panel_height;
+}
+
+void build_equirect(unsigned int width, unsigned int height) {
+  // columns: overlap in longitude
+  reset_table(&weights.cols, geometry.panel_width);
+  for (unsigned int x = 0; x < geometry.panel_width; x++) {
+    double x0 = (double) x * width / geometry.panel_width;
+    double x1 = (double) (x + 1) * width / geometry.panel_width;
+    begin_span(&weights.cols, x);
+    for (unsigned int sx = x0; sx < x1 && sx < width; sx++) {
+      double overlap = fmin(x1, sx + 1) - fmax(x0, sx);
+      if (overlap > 0)
+        add_tap(&weights.cols, sx, overlap);
+    }
+    end_span(&weights.cols, x);
+  }
+
+  // rows: area of the overlap in latitude, which shrinks towards the poles
+  reset_table(&weights.rows, geometry.panel_height);
+  for (unsigned int y = 0; y < geometry.panel_height; y++) {
+    double lat0 = row_latitude(y, 0);
+    double lat1 = row_latitude(y, 1);
+    begin_span(&weights.rows, y);
+    for (unsigned int sy = 0; sy < height; sy++) {
+      double slat0 = 90 - 180.0 * sy / height;
+      double slat1 = 90 - 180.0 * (sy + 1) / height;
+      double top = fmin(lat0, slat0);
+      double bottom = fmax(lat1, slat1);
+      if (top > bottom)
+        add_tap(&weights.rows, sy, sin(top * DEG_TO_RAD) - sin(bottom * DEG_TO_RAD));
+    }
+    end_span(&weights.rows, y);
+  }
+
+  free(weights.reduced);
+  weights.reduced = malloc((size_t) height * geometry.panel_width * RGB_SIZE * sizeof(float));
+  if (weights.reduced == NULL)
+    error("ERROR allocating resample buffer");
+}
+
+// image pixel of a cubemap in direction (x, y, z), Y up
+uint32_t cubemap_pixel(unsigned int size, double x, double y, double z) {
+  double ax = fabs(x), ay = fabs(y), az = fabs(z);
+  unsigned int face;
+  double ma, sc, tc;
+  if (ax >= ay && ax >= az) {
+    face = x > 0 ? 0 : 1;
+    ma = ax; sc = x > 0 ? -z : z; tc = -y;
+  } else if (ay >= az) {
+    face = y > 0 ? 2 : 3;
+    ma = ay; sc = x; tc = y > 0 ? z : -z;
+  } else {
+    face = z > 0 ? 4 : 5;
+    ma = az; sc = z > 0 ? x : -x; tc = -y;
+  }
+
+  int u = (sc / ma + 1) / 2 * size;
+  int v = (tc / ma + 1) / 2 * size;
+  u = u < 0 ? 0 : u >= (int) size ? (int) size - 1 : u;
+  v = v < 0 ? 0 : v >= (int) size ? (int) size - 1 : v;
+  return (face * size + v) * size + u;
+}
+
+void build_cubemap(unsigned int size) {
+  unsigned int num_pixels = geometry.panel_width * geometry.panel_height;
+  reset_table(&weights.pixels, num_pixels);
+
+  double lon_step = 360.0 / geometry.panel_width;
+  double face_step = 90.0 / size;  // degrees per face pixel, about
+
+  for (unsigned int y = 0; y < geometry.panel_height; y++) {
+    double lat0 = row_latitude(y, 0);
+    double lat1 = row_latitude(y, 1);
+    double extent = fmax(lon_step * cos((lat0 + lat1) / 2 * DEG_TO_RAD), lat0 - lat1);
+    unsigned int n = ceil(extent / face_step);
+    n = n < 1 ? 1 : n > MAX_SUPERSAMPLE ? MAX_SUPERSAMPLE : n;
+
+    for (unsigned int x = 0; x < geometry.panel_width; x++) {
+      unsigned int i = y * geometry.panel_width + x;
+      begin_span(&weights.pixels, i);
+
+      for (unsigned int j = 0; j < n; j++) {
+        double lat = (lat0 + (lat1 - lat0) * (j + 0.5) / n) * DEG_TO_RAD;
+        for (unsigned int k = 0; k < n; k++) {
+          double lon = (x + (k + 0.5) / n) * lon_step * DEG_TO_RAD;
+          uint32_t src = cubemap_pixel(size, cos(lat) * cos(lon), sin(lat), cos(lat) * sin(lon));
+
+          // samples of a patch often land on the same face pixel
+          unsigned int t = weights.pixels.spans[i].start;
+          while (t < weights.pixels.num_taps && weights.pixels.taps[t].src != src)
+            t++;
+          if (t < weights.pixels.num_taps)
+            weights.pixels.taps[t].weight += cos(lat);
+          else
+            add_tap(&weights.pixels, src, cos(lat));
+        }
+      }
+
+      end_span(&weights.pixels, i);
+    }
+  }
+}
+
+void build_weights(unsigned int projection, unsigned int width, unsigned int height) {
+  if (weights.valid && weights.projection == projection && weights.width == width && weights.height == height)
+    return;
+
+  if (projection == RESAMPLE_EQUIRECT)
+    build_equirect(width, height);
+  else
+    build_cubemap(width);
+
+  weights.valid = true;
+  weights.projection = projection;
+  weights.width = width;
+  weights.height = height;
+}
+
+// equirect pass 1: reduce image rows [begin, end) to the panel width
+void reduce_rows(unsigned int begin, unsigned int end) {
+  for (unsigned int sy = begin; sy < end; sy++) {
+    const uint8_t *in = job_rgb + (size_t) sy * weights.width * RGB_SIZE;
+    float *out = weights.reduced + (size_t) sy * geometry.panel_width * RGB_SIZE;
+    for (unsigned int x = 0; x < geometry.panel_width; x++) {
+      const tap_span_t *span = &weights.cols.spans[x];
+      float r = 0, g = 0, b = 0;
+      for (unsigned int t = 0; t < span->count; t++) {
+        const tap_t *tap = &weights.cols.taps[span->start + t];
+        const uint8_t *p = in + tap->src * RGB_SIZE;
+        r += p[0] * tap->weight;
+        g += p[1] * tap->weight;
+        b += p[2] * tap->weight;
+      }
+      out[x * RGB_SIZE] = r;
+      out[x * RGB_SIZE + 1] = g;
+      out[x * RGB_SIZE + 2] = b;
+    }
+  }
+}
+
+void put_pixel(uint8_t *p, float r, float g, float b) {
+  p[0] = 0;
+  p[1] = r + 0.5f;
+  p[2] = g + 0.5f;
+  p[3] = b + 0.5f;
+}
+
+// equirect pass 2: combine the reduced rows into panel rows [begin, end)
+void combine_rows(unsigned int begin, unsigned int end) {
+  for (unsigned int y = begin; y < end; y++) {
+    const tap_span_t *span = &weights.rows.spans[y];
+    for (unsigned int x = 0; x < geometry.panel_width; x++) {
+      float r = 0, g = 0, b = 0;
+      for (unsigned int t = 0; t < span->count; t++) {
+        const tap_t *tap = &weights.rows.taps[span->start + t];
+        const float *p = weights.reduced + ((size_t) tap->src * geometry.panel_width + x) * RGB_SIZE;
+        r += p[0] * tap->weight;
+        g += p[1] * tap->weight;
+        b += p[2] * tap->weight;
+      }
+      put_pixel(job_panel + (y * geometry.panel_width + x) * PIXEL_SIZE, r, g, b);
+    }
+  }
+}
+
+// cubemap: panel rows [begin, end) straight from the pixel weights
+void sample_rows(unsigned int begin, unsigned int end) {
+  for (unsigned int i = begin * geometry.panel_width; i < end * geometry.panel_width; i++) {
+    const tap_span_t *span = &weights.pixels.spans[i];
+    float r = 0, g = 0, b = 0;
+    for (unsigned int t = 0; t < span->count; t++) {
+      const tap_t *tap = &weights.pixels.taps[span->start + t];
+      const uint8_t *p = job_rgb + (size_t) tap->src * RGB_SIZE;
+      r += p[0] * tap->weight;
+      g += p[1] * tap->weight;
+      b += p[2] * tap->weight;
+    }
+    put_pixel(job_panel + i * PIXEL_SIZE, r, g, b);
+  }
+}
+
+void *work_func(void *arg) {
+  work_t *work = arg;
+  work->func(work->begin, work->end);
+  return NULL;
+}
+
+// run func over [0, n) split across the threads, this one included
+void run_parallel(void (*func)(unsigned int begin, unsigned int end), unsigned int n) {
+  pthread_t threads[MAX_THREADS];
+  work_t work[MAX_THREADS];
+
+  for (unsigned int i = 0; i < num_threads; i++) {
+    work[i].func = func;
+    work[i].begin = (uint64_t) n * i / num_threads;
+    work[i].end = (uint64_t) n * (i + 1) / num_threads;
+    if (i > 0 && pthread_create(&threads[i], NULL, work_func, &work[i]) != 0)
+      error("ERROR starting resample thread");
+  }
+
+  func(work[0].begin, work[0].end);
+  for (unsigned int i = 1; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+}
+
+/*
+ * Resample width x height RGB pixels in the given projection into panel.
+ * Returns false if the dimensions do not fit the projection.
+ */
+bool resample(uint8_t *panel, unsigned int projection, unsigned int width, unsigned int height, const uint8_t *rgb) {
+  if (width == 0 || height == 0)
+    return false;
+  if (projection == RESAMPLE_CUBEMAP && height != 6 * width)
+    return false;
+  if (projection != RESAMPLE_EQUIRECT && projection != RESAMPLE_CUBEMAP)
+    return false;
+
+  build_weights(projection, width, height);
+  job_rgb = rgb;
+  job_panel = panel;
+
+  if (projection == RESAMPLE_EQUIRECT) {
+    run_parallel(reduce_rows, height);
+    run_parallel(combine_rows, geometry.panel_height);
+  } else {
+    run_parallel(sample_rows, geometry.panel_height);
+  }
+  return true;
+}
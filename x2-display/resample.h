@@ -0,0 +1,31 @@
+#ifndef _resample_h_
+#define _resample_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+
+/*
+ * Resamples images of any size to a panel, so that clients can send
+ * ordinary equirectangular or cubemap images instead of pre-rendering
+ * panels for this sphere.
+ *
+ * Each panel pixel is the area-weighted average of the part of the image
+ * that its LED sweeps, from a weight table built once per image size and
+ * projection.  The work is split across resample_threads worker threads.
+ */
+
+#define RESAMPLE_EQUIRECT 0  // width x height, longitude left to right, north at the top
+#define RESAMPLE_CUBEMAP 1   // six width x width faces stacked: +X, -X, +Y, -Y, +Z, -Z, Y up
+
+
+extern uint32_t max_image_size;  // largest image message accepted, bytes
+extern double top_latitude;       // of the top edge of the panel, degrees
+extern double bottom_latitude;    // of the bottom edge
+
+
+extern void resample_init();
+extern bool resample(uint8_t *panel, unsigned int projection, unsigned int width, unsigned int height, const uint8_t *rgb);
+
+
+#endif
@@ -0,0 +1,103 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "config.h"
+#include "err.h"
+#include "geometry.h"
+#include "slice-filter.h"
+
+
+#define DEFAULT_LED_DUTY 1.0
+
+
+bool filtering;
+double led_duty;  // fraction of a slice interval the LEDs are lit
+
+slice_taps_t *taps;
+unsigned int taps_slices = 0;  // slices per rotation the table is for
+unsigned int taps_phase = 0;   // and fractional x offset
+
+
+void slice_filter_init() {
+  filtering = config_int("slice_filter", 0);
+  led_duty = config_double("led_duty", DEFAULT_LED_DUTY);
+  if (led_duty <= 0 || led_duty > 1)
+    error("ERROR led_duty must be more than 0 and at most 1");
+
+  if (filtering)
+    printf("Filtering slices over %.0f%% of their sweep\n", led_duty * 100);
+}
+
+// weights of the columns swept by the slice starting at pos, phase columns
+// on; or without filtering, of the column it starts in, and the next
+void build_taps(slice_taps_t *t, unsigned int pos, unsigned int num_slices, double phase) {
+  const unsigned int panel_width = geometry.panel_width;
+  double start, width;
+  if (filtering) {
+    start = (double) pos * panel_width / num_slices + phase;
+    width = led_duty * panel_width / num_slices;
+  } else {
+    start = pos * panel_width / num_slices + phase;
+    width = 1;
+  }
+  double end = start + width;
+
+  unsigned int first = start;
+  unsigned int num_cols = (unsigned int) ceil(end) - first;
+  if (num_cols == 0)
+    num_cols = 1;
+  unsigned int stride = (num_cols + FILTER_MAX_TAPS - 1) / FILTER_MAX_TAPS;
+  unsigned int num_taps = (num_cols + stride - 1) / stride;
+
+  // coverage of each tap's columns, rounded so that the weights sum exactly
+  // to one, the remainder going to the largest
+  const int one = 1 << FILTER_BITS;
+  int sum = 0;
+  unsigned int largest = 0;
+  for (unsigned int i = 0; i < num_taps; i++) {
+    double lo = fmax(start, first + i * stride);
+    double hi = fmin(end, first + (i + 1) * stride);
+    int w = lround(one * (hi - lo) / width);
+    t->weights[i] = w > 0 ? w : 0;
+    sum += t->weights[i];
+    if (t->weights[i] > t->weights[largest])
+      largest = i;
+  }
+  t->weights[largest] += one - sum;
+
+  // drop taps that round to nothing at either end
+  unsigned int skip = 0;
+  while (skip < largest && t->weights[skip] == 0)
+    skip++;
+  while (num_taps > largest + 1 && t->weights[num_taps - 1] == 0)
+    num_taps--;
+  for (unsigned int i = skip; i < num_taps; i++)
+    t->weights[i - skip] = t->weights[i];
+
+  t->first = first + skip * stride;
+  t->stride = stride;
+  t->num_taps = num_taps - skip;
+}
+
+/*
+ * The filter for a rotation of num_slices slices at a fractional x offset of
+ * phase / 2^FILTER_BITS columns, indexed by slice position, or NULL to sample
+ * one column per slice.  Only the drawing thread calls this; the table is
+ * rebuilt when the resolution or phase changes.
+ */
+const slice_taps_t *slice_filter(unsigned int num_slices, unsigned int phase) {
+  if (!filtering && phase == 0)
+    return NULL;
+  if (num_slices == taps_slices && phase == taps_phase)
+    return taps;
+
+  taps = realloc(taps, num_slices * sizeof(slice_taps_t));
+  if (taps == NULL)
+    error("ERROR allocating slice filter");
+  for (unsigned int pos = 0; pos < num_slices; pos++)
+    build_taps(&taps[pos], pos, num_slices, (double) phase / (1 << FILTER_BITS));
+  taps_slices = num_slices;
+  taps_phase = phase;
+  return taps;
+}
@@ -0,0 +1,39 @@
+#ifndef _slice_filter_h_
+#define _slice_filter_h_
+
+#include <inttypes.h>
+
+
+/*
+ * Angular anti-aliasing for the render kernels.
+ *
+ * Without a filter each slice shows the single panel column it starts in,
+ * so detail narrower than a slice aliases and crawls as x_offset changes.
+ * With one, each slice shows the average of the panel columns its LEDs
+ * sweep while they are lit (led_duty of the slice interval), each weighted
+ * by how much of the sweep it covers.  The weights are tabulated per slice
+ * position whenever the number of slices per rotation changes, so rendering
+ * costs one multiply-add per tap and channel.
+ *
+ * The same tables carry fractional x offsets, for smooth spinning: the
+ * sweep is shifted by the fraction of a column, or without filtering each
+ * slice blends the column it starts in with the next.
+ */
+
+#define FILTER_MAX_TAPS 8
+#define FILTER_BITS 8  // weights of a slice sum to 1 << FILTER_BITS; see color_lerp()
+
+
+typedef struct {
+  uint16_t first;   // first panel column swept, before x_offset and mirroring
+  uint8_t stride;   // columns between taps, more than 1 for very wide slices
+  uint8_t num_taps;
+  uint16_t weights[FILTER_MAX_TAPS];
+} slice_taps_t;
+
+
+extern void slice_filter_init();
+extern const slice_taps_t *slice_filter(unsigned int num_slices, unsigned int phase);
+
+
+#endif
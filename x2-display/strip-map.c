@@ -1,34 +1,144 @@
-//externs
-int strip_map[] = {
-  23, // 21
-  20, // 22
-  14, // 23
-   1, // 20
-
-  21, // 17
-   5, // 18 X
-   3, // 19 X
-   7, // 16
-
-  19, // 13
-  13, // 14
-  18, // 15
-  12, // 12
-
-   4, //  9
-  10, // 10
-  16, // 11
-   9, //  8
-
-   8, //  5
-   0, //  6
-  22, //  7
-   2, //  4 X
-
-  17, //  1
-   6, //  2 X
-  15, //  3
-  11, //  0
-};
-
-//not working: 6, 5, 3, 2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "geometry.h"
+#include "strip-map.h"
+#include "wiring.h"
+#include "x2-server.h"
+
+
+#define MAX_LINE 256
+
+
+typedef struct {
+  unsigned int bank;
+  unsigned int pin;
+} wiring_pin_t;
+
+
+// externs
+int strip_map[LEDSCAPE_NUM_STRIPS] = { WIRING_STRIP_MAP };
+
+
+const wiring_pin_t built_pins[] = { WIRING_PINS };  // as the firmware was built
+const char *wiring_path;
+
+int pending_map[LEDSCAPE_NUM_STRIPS];  // protected by lock
+bool map_pending = false;              // protected by lock
+
+
+// check that every strip has a lane, and no lane two strips
+bool check_map(const int *map, const char *source) {
+  bool used[LEDSCAPE_NUM_STRIPS] = { false };
+  for (unsigned int strip_idx = 0; strip_idx < geometry.num_strips; strip_idx++) {
+    int lane = map[strip_idx];
+    if (lane < 0 || lane >= LEDSCAPE_NUM_STRIPS || used[lane]) {
+      fprintf(stderr, "%s: invalid strip map: strip %u on lane %d\n", source, strip_idx, lane);
+      return false;
+    }
+    used[lane] = true;
+  }
+  return true;
+}
+
+/*
+ * Read the strip column of the wiring file into map.  The pins must be the
+ * ones the firmware was built with, since changing them needs a rebuild.
+ * Returns false, having reported why, if the file cannot be used.
+ */
+bool read_wiring(int *map) {
+  FILE *f = fopen(wiring_path, "r");
+  if (f == NULL) {
+    perror(wiring_path);
+    return false;
+  }
+
+  for (int i = 0; i < LEDSCAPE_NUM_STRIPS; i++)
+    map[i] = -1;
+
+  char line[MAX_LINE];
+  int line_num = 0;
+  unsigned int num_lanes = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), f) != NULL) {
+    line_num++;
+    char *comment = strchr(line, '#');
+    if (comment != NULL)
+      *comment = '\0';
+
+    char lane[8], strip[8];
+    unsigned int bank, pin;
+    int n = sscanf(line, " %7s %u %u %7s", lane, &bank, &pin, strip);
+    if (n <= 0)
+      continue;
+    if (n != 4) {
+      fprintf(stderr, "%s:%d: expected lane, gpio, pin and strip\n", wiring_path, line_num);
+      ok = false;
+    } else if (strcmp(lane, "-") == 0) {
+      continue;
+    } else if ((unsigned int) atoi(lane) != num_lanes || num_lanes >= WIRING_NUM_LANES) {
+      fprintf(stderr, "%s:%d: lanes must be in order from 0 to %d\n", wiring_path, line_num, WIRING_NUM_LANES - 1);
+      ok = false;
+    } else if (bank != built_pins[num_lanes].bank || pin != built_pins[num_lanes].pin) {
+      fprintf(stderr, "%s:%d: lane %u was built on GPIO%u pin %u; rebuild to change pins\n",
+          wiring_path, line_num, num_lanes, built_pins[num_lanes].bank, built_pins[num_lanes].pin);
+      ok = false;
+    } else {
+      if (strcmp(strip, "-") != 0) {
+        unsigned int strip_idx = atoi(strip);
+        if (strip_idx >= geometry.num_strips || map[strip_idx] >= 0) {
+          fprintf(stderr, "%s:%d: strip %s is not in the geometry, or on two lanes\n", wiring_path, line_num, strip);
+          ok = false;
+        } else {
+          map[strip_idx] = num_lanes;
+        }
+      }
+      num_lanes++;
+    }
+  }
+  fclose(f);
+
+  return ok && check_map(map, wiring_path);
+}
+
+void strip_map_init() {
+  wiring_path = config_string("wiring", NULL);
+  if (wiring_path && !read_wiring(strip_map))
+    exit(1);
+  if (!check_map(strip_map, wiring_path ? wiring_path : "wiring.conf"))
+    exit(1);
+}
+
+/*
+ * Reload the wiring file, to be swapped in by the drawing thread at the start
+ * of the next rotation.
+ */
+bool strip_map_load() {
+  if (wiring_path == NULL)
+    return true;
+
+  int map[LEDSCAPE_NUM_STRIPS];
+  if (!read_wiring(map))
+    return false;
+
+  pthread_mutex_lock(&lock);
+  memcpy(pending_map, map, sizeof(map));
+  map_pending = true;
+  pthread_mutex_unlock(&lock);
+  printf("Reloaded the strip map from %s\n", wiring_path);
+  return true;
+}
+
+/*
+ * Take a reloaded strip map, between rotations and with lock held.  Returns
+ * whether the map changed, in which case lanes may have fallen out of use
+ * and the frames should be cleared.
+ */
+bool strip_map_update() {
+  if (!map_pending)
+    return false;
+  memcpy(strip_map, pending_map, sizeof(strip_map));
+  map_pending = false;
+  return true;
+}
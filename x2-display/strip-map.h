@@ -1,8 +1,22 @@
 #ifndef _strip_map_h_
 #define _strip_map_h_
 
+#include <stdbool.h>
+#include "ledscape.h"
 
-extern int strip_map[];
+
+/*
+ * The PRU lane that drives each strip, from wiring.conf: as built, or read
+ * from the file named by the wiring setting at startup and again on SIGHUP.
+ * A reloaded map takes effect from the next rotation.
+ */
+
+extern int strip_map[LEDSCAPE_NUM_STRIPS];
+
+
+extern void strip_map_init();
+extern bool strip_map_load();
+extern bool strip_map_update();
 
 
 #endif
@@ -0,0 +1,164 @@
+/*
+ * Text layers; see text.h.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compositor.h"
+#include "drawing.h"
+#include "geometry.h"
+#include "text.h"
+
+
+#define GLYPH_WIDTH 5
+#define GLYPH_HEIGHT 7
+#define CELL_WIDTH (GLYPH_WIDTH + 1)
+#define FIRST_CHAR ' '
+#define LAST_CHAR '~'
+
+
+// printable ASCII, a byte per glyph column, top row in bit 0
+const uint8_t font[LAST_CHAR - FIRST_CHAR + 1][GLYPH_WIDTH] = {
+  { 0x00, 0x00, 0x00, 0x00, 0x00 },  // space
+  { 0x00, 0x00, 0x5f, 0x00, 0x00 },  // !
+  { 0x00, 0x07, 0x00, 0x07, 0x00 },  // "
+  { 0x14, 0x7f, 0x14, 0x7f, 0x14 },  // #
+  { 0x24, 0x2a, 0x7f, 0x2a, 0x12 },  // $
+  { 0x23, 0x13, 0x08, 0x64, 0x62 },  // %
+  { 0x36, 0x49, 0x56, 0x20, 0x50 },  // &
+  { 0x00, 0x00, 0x07, 0x00, 0x00 },  // '
+  { 0x00, 0x1c, 0x22, 0x41, 0x00 },  // (
+  { 0x00, 0x41, 0x22, 0x1c, 0x00 },  // )
+  { 0x14, 0x08, 0x3e, 0x08, 0x14 },  // *
+  { 0x08, 0x08, 0x3e, 0x08, 0x08 },  // +
+  { 0x00, 0x50, 0x30, 0x00, 0x00 },  // ,
+  { 0x08, 0x08, 0x08, 0x08, 0x08 },  // -
+  { 0x00, 0x60, 0x60, 0x00, 0x00 },  // .
+  { 0x20, 0x10, 0x08, 0x04, 0x02 },  // /
+  { 0x3e, 0x51, 0x49, 0x45, 0x3e },  // 0
+  { 0x00, 0x42, 0x7f, 0x40, 0x00 },  // 1
+  { 0x42, 0x61, 0x51, 0x49, 0x46 },  // 2
+  { 0x21, 0x41, 0x45, 0x4b, 0x31 },  // 3
+  { 0x18, 0x14, 0x12, 0x7f, 0x10 },  // 4
+  { 0x27, 0x45, 0x45, 0x45, 0x39 },  // 5
+  { 0x3c, 0x4a, 0x49, 0x49, 0x30 },  // 6
+  { 0x01, 0x71, 0x09, 0x05, 0x03 },  // 7
+  { 0x36, 0x49, 0x49, 0x49, 0x36 },  // 8
+  { 0x06, 0x49, 0x49, 0x29, 0x1e },  // 9
+  { 0x00, 0x36, 0x36, 0x00, 0x00 },  // :
+  { 0x00, 0x56, 0x36, 0x00, 0x00 },  // ;
+  { 0x08, 0x14, 0x22, 0x41, 0x00 },  // <
+  { 0x14, 0x14, 0x14, 0x14, 0x14 },  // =
+  { 0x00, 0x41, 0x22, 0x14, 0x08 },  // >
+  { 0x02, 0x01, 0x51, 0x09, 0x06 },  // ?
+  { 0x32, 0x49, 0x79, 0x41, 0x3e },  // @
+  { 0x7e, 0x11, 0x11, 0x11, 0x7e },  // A
+  { 0x7f, 0x49, 0x49, 0x49, 0x36 },  // B
+  { 0x3e, 0x41, 0x41, 0x41, 0x22 },  // C
+  { 0x7f, 0x41, 0x41, 0x22, 0x1c },  // D
+  { 0x7f, 0x49, 0x49, 0x49, 0x41 },  // E
+  { 0x7f, 0x09, 0x09, 0x09, 0x01 },  // F
+  { 0x3e, 0x41, 0x49, 0x49, 0x7a },  // G
+  { 0x7f, 0x08, 0x08, 0x08, 0x7f },  // H
+  { 0x00, 0x41, 0x7f, 0x41, 0x00 },  // I
+  { 0x20, 0x40, 0x41, 0x3f, 0x01 },  // J
+  { 0x7f, 0x08, 0x14, 0x22, 0x41 },  // K
+  { 0x7f, 0x40, 0x40, 0x40, 0x40 },  // L
+  { 0x7f, 0x02, 0x0c, 0x02, 0x7f },  // M
+  { 0x7f, 0x04, 0x08, 0x10, 0x7f },  // N
+  { 0x3e, 0x41, 0x41, 0x41, 0x3e },  // O
+  { 0x7f, 0x09, 0x09, 0x09, 0x06 },  // P
+  { 0x3e, 0x41, 0x51, 0x21, 0x5e },  // Q
+  { 0x7f, 0x09, 0x19, 0x29, 0x46 },  // R
+  { 0x46, 0x49, 0x49, 0x49, 0x31 },  // S
+  { 0x01, 0x01, 0x7f, 0x01, 0x01 },  // T
+  { 0x3f, 0x40, 0x40, 0x40, 0x3f },  // U
+  { 0x1f, 0x20, 0x40, 0x20, 0x1f },  // V
+  { 0x3f, 0x40, 0x38, 0x40, 0x3f },  // W
+  { 0x63, 0x14, 0x08, 0x14, 0x63 },  // X
+  { 0x07, 0x08, 0x70, 0x08, 0x07 },  // Y
+  { 0x61, 0x51, 0x49, 0x45, 0x43 },  // Z
+  { 0x00, 0x7f, 0x41, 0x41, 0x00 },  // [
+  { 0x02, 0x04, 0x08, 0x10, 0x20 },  // backslash
+  { 0x00, 0x41, 0x41, 0x7f, 0x00 },  // ]
+  { 0x04, 0x02, 0x01, 0x02, 0x04 },  // ^
+  { 0x40, 0x40, 0x40, 0x40, 0x40 },  // _
+  { 0x00, 0x01, 0x02, 0x04, 0x00 },  // `
+  { 0x20, 0x54, 0x54, 0x54, 0x78 },  // a
+  { 0x7f, 0x48, 0x44, 0x44, 0x38 },  // b
+  { 0x38, 0x44, 0x44, 0x44, 0x20 },  // c
+  { 0x38, 0x44, 0x44, 0x48, 0x7f },  // d
+  { 0x38, 0x54, 0x54, 0x54, 0x18 },  // e
+  { 0x08, 0x7e, 0x09, 0x01, 0x02 },  // f
+  { 0x0c, 0x52, 0x52, 0x52, 0x3e },  // g
+  { 0x7f, 0x08, 0x04, 0x04, 0x78 },  // h
+  { 0x00, 0x44, 0x7d, 0x40, 0x00 },  // i
+  { 0x20, 0x40, 0x44, 0x3d, 0x00 },  // j
+  { 0x7f, 0x10, 0x28, 0x44, 0x00 },  // k
+  { 0x00, 0x41, 0x7f, 0x40, 0x00 },  // l
+  { 0x7c, 0x04, 0x18, 0x04, 0x78 },  // m
+  { 0x7c, 0x08, 0x04, 0x04, 0x78 },  // n
+  { 0x38, 0x44, 0x44, 0x44, 0x38 },  // o
+  { 0x7c, 0x14, 0x14, 0x14, 0x08 },  // p
+  { 0x08, 0x14, 0x14, 0x18, 0x7c },  // q
+  { 0x7c, 0x08, 0x04, 0x04, 0x08 },  // r
+  { 0x48, 0x54, 0x54, 0x54, 0x20 },  // s
+  { 0x04, 0x3f, 0x44, 0x40, 0x20 },  // t
+  { 0x3c, 0x40, 0x40, 0x20, 0x7c },  // u
+  { 0x1c, 0x20, 0x40, 0x20, 0x1c },  // v
+  { 0x3c, 0x40, 0x30, 0x40, 0x3c },  // w
+  { 0x44, 0x28, 0x10, 0x28, 0x44 },  // x
+  { 0x0c, 0x50, 0x50, 0x50, 0x3c },  // y
+  { 0x44, 0x64, 0x54, 0x4c, 0x44 },  // z
+  { 0x00, 0x08, 0x36, 0x41, 0x00 },  // {
+  { 0x00, 0x00, 0x7f, 0x00, 0x00 },  // |
+  { 0x00, 0x41, 0x36, 0x08, 0x00 },  // }
+  { 0x08, 0x04, 0x08, 0x10, 0x08 },  // ~
+};
+
+
+/*
+ * Rasterize text into style->layer, replacing what was there.  Characters
+ * outside printable ASCII are drawn as '?'.  Returns false if the layer
+ * does not exist or the text is too wide or tall.
+ */
+bool text_layer(const text_style_t *style, const char *text, unsigned int len) {
+  const unsigned int scale = style->scale;
+  if (scale < 1 || scale > TEXT_MAX_SCALE || len * CELL_WIDTH * scale > TEXT_MAX_COLUMNS || len == 0 ||
+      !isfinite(style->width) || style->width < 0 || style->width > 360)
+    return false;
+
+  // the band shown, and the text padded out to it
+  unsigned int text_width = len * CELL_WIDTH * scale;
+  unsigned int width = lround(style->width * geometry.panel_width / 360);
+  if (width == 0)
+    width = text_width;
+  if (width > geometry.panel_width)
+    width = geometry.panel_width;
+  unsigned int stride = text_width > width ? text_width : width;
+  unsigned int height = GLYPH_HEIGHT * scale;
+
+  uint8_t *pixels = malloc(stride * height * PIXEL_SIZE);
+  if (pixels == NULL)
+    return false;
+  for (unsigned int i = 0; i < stride * height; i++)
+    memcpy(pixels + i * PIXEL_SIZE, style->background, PIXEL_SIZE);
+
+  for (unsigned int i = 0; i < len; i++) {
+    unsigned char c = text[i];
+    const uint8_t *glyph = font[(c >= FIRST_CHAR && c <= LAST_CHAR ? c : '?') - FIRST_CHAR];
+    for (unsigned int gx = 0; gx < GLYPH_WIDTH; gx++)
+      for (unsigned int gy = 0; gy < GLYPH_HEIGHT; gy++) {
+        if (!(glyph[gx] & (1 << gy)))
+          continue;
+        for (unsigned int sy = 0; sy < scale; sy++) {
+          uint8_t *p = pixels + ((gy * scale + sy) * stride + (i * CELL_WIDTH + gx) * scale) * PIXEL_SIZE;
+          for (unsigned int sx = 0; sx < scale; sx++)
+            memcpy(p + sx * PIXEL_SIZE, style->color, PIXEL_SIZE);
+        }
+      }
+  }
+
+  return layer_put(style->layer, pixels, stride, width, height, style->longitude, style->latitude, style->speed);
+}
@@ -0,0 +1,37 @@
+#ifndef _text_h_
+#define _text_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+
+/*
+ * Text rendered on the device into an overlay layer (see compositor.h),
+ * for labels and marquees without streaming panels.
+ *
+ * Strings are laid out in a built-in 5x7 font, one 6 column cell per
+ * character, scaled up by whole pixels, and rasterized once into a layer
+ * covering a band of the sphere.  Text longer than the band scrolls through
+ * it as the layer scrolls, so a running marquee costs no rasterizing at all.
+ */
+
+#define TEXT_MAX_COLUMNS 4096  // rasterized width, before it is shown in a band
+#define TEXT_MAX_SCALE 8
+
+
+typedef struct {
+  unsigned int layer;
+  unsigned int scale;      // pixels per font pixel, 1 to TEXT_MAX_SCALE
+  double longitude;        // of the left edge of the band, degrees
+  double latitude;         // of the top edge
+  double width;            // of the band, degrees; 0 to fit the text
+  double speed;            // degrees per second the text scrolls
+  uint8_t color[4];        // alpha, red, green, blue
+  uint8_t background[4];
+} text_style_t;
+
+
+extern bool text_layer(const text_style_t *style, const char *text, unsigned int len);
+
+
+#endif
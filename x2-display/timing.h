@@ -6,7 +6,7 @@
 
 
 extern bool new_frame;
-extern uint64_t display_interval_usec;
+extern uint64_t rotation_usec;  // measured period of the last rotation
 extern double rps;  // rotations per second
 
 
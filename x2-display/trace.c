@@ -0,0 +1,235 @@
+/*
+ * Reader side of the trace rings: aggregates events into histograms and
+ * optionally streams them out as Chrome trace JSON.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "err.h"
+#include "trace.h"
+#include "x2-server.h"
+
+
+#define TRACE_POLL_USEC (50 * 1000)
+#define PRU_TID TRACE_NUM_THREADS  // Chrome trace row for the PRU transfers
+
+
+// externs
+trace_ring_t trace_rings[TRACE_NUM_THREADS];
+const char *trace_hist_names[TRACE_NUM_HISTS] = {
+  "slice", "submit", "render", "transfer", "jitter", "rotation",
+};
+
+
+const char *trace_thread_names[TRACE_NUM_THREADS] = {
+  "drawing", "timing", "server",
+};
+
+pthread_mutex_t hist_lock = PTHREAD_MUTEX_INITIALIZER;
+hdr_hist_t hists[TRACE_NUM_HISTS];
+uint64_t event_counts[TRACE_NUM_EVENTS];
+
+FILE *trace_file;
+uint64_t trace_start_nsec;
+
+// last events seen on the drawing and timing threads, to pair them up
+trace_event_t slice_start;
+trace_event_t pru_submit;
+uint64_t last_rotation_nsec;
+
+
+unsigned int hdr_bucket(uint64_t value) {
+  if (value < HDR_SUB_BUCKETS)
+    return value;
+  unsigned int shift = 63 - __builtin_clzll(value) - HDR_SUB_BITS;
+  unsigned int sub = (value >> shift) & (HDR_SUB_BUCKETS - 1);
+  return (shift + 1) * HDR_SUB_BUCKETS + sub;
+}
+
+uint64_t hdr_bucket_max(unsigned int bucket) {
+  if (bucket < HDR_SUB_BUCKETS)
+    return bucket;
+  unsigned int shift = bucket / HDR_SUB_BUCKETS - 1;
+  uint64_t sub = bucket % HDR_SUB_BUCKETS;
+  return ((HDR_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void hdr_record(hdr_hist_t *hist, uint64_t value) {
+  if (hist->count == 0 || value < hist->min)
+    hist->min = value;
+  if (value > hist->max)
+    hist->max = value;
+  hist->count++;
+  hist->sum += value;
+  hist->buckets[hdr_bucket(value)]++;
+}
+
+uint64_t hdr_percentile(const hdr_hist_t *hist, double pct) {
+  if (hist->count == 0)
+    return 0;
+
+  uint64_t target = hist->count * pct / 100;
+  if (target == 0)
+    target = 1;
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < HDR_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= target) {
+      uint64_t value = hdr_bucket_max(i);
+      return value < hist->max ? value : hist->max;
+    }
+  }
+  return hist->max;
+}
+
+/*
+ * Number of recorded values at most value, counting a bucket once its upper
+ * bound is within value.
+ */
+uint64_t hdr_count_le(const hdr_hist_t *hist, uint64_t value) {
+  uint64_t count = 0;
+  for (unsigned int i = 0; i < HDR_BUCKETS && hdr_bucket_max(i) <= value; i++)
+    count += hist->buckets[i];
+  return count;
+}
+
+void trace_histograms(hdr_hist_t *out) {
+  pthread_mutex_lock(&hist_lock);
+  memcpy(out, hists, sizeof(hists));
+  pthread_mutex_unlock(&hist_lock);
+}
+
+void trace_open(const char *path) {
+  trace_file = fopen(path, "w");
+  if (trace_file == NULL)
+    error("ERROR opening trace file");
+
+  fprintf(trace_file, "[\n");
+  for (int t = 0; t < TRACE_NUM_THREADS; t++)
+    fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+        t, trace_thread_names[t]);
+  fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"pru\"}},\n",
+      PRU_TID);
+
+  printf("Tracing to %s\n", path);
+}
+
+double trace_usec(uint64_t nsec) {
+  return (nsec - trace_start_nsec) / 1000.0;
+}
+
+void write_complete(const char *name, unsigned int slice, int tid, uint64_t start_nsec, uint64_t end_nsec) {
+  fprintf(trace_file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"slice\":%u}},\n",
+      name, tid, trace_usec(start_nsec), (end_nsec - start_nsec) / 1000.0, slice);
+}
+
+void write_instant(const char *name, int tid, const trace_event_t *e) {
+  fprintf(trace_file, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"slice\":%u,\"value\":%" PRIu32 "}},\n",
+      name, tid, trace_usec(e->nsec), e->slice, e->value);
+}
+
+void process_event(trace_thread_t thread, const trace_event_t *e) {
+  event_counts[e->type]++;
+
+  switch (e->type) {
+  case TRACE_SLICE_START:
+    slice_start = *e;
+    hdr_record(&hists[TRACE_HIST_JITTER], e->value);
+    break;
+  case TRACE_PRU_SUBMIT:
+    pru_submit = *e;
+    if (slice_start.slice == e->slice && e->nsec >= slice_start.nsec)
+      hdr_record(&hists[TRACE_HIST_SUBMIT], e->nsec - slice_start.nsec);
+    break;
+  case TRACE_RENDER_DONE:
+    if (e->nsec >= pru_submit.nsec)
+      hdr_record(&hists[TRACE_HIST_RENDER], e->nsec - pru_submit.nsec);
+    break;
+  case TRACE_PRU_DONE:
+    if (slice_start.slice == e->slice && e->nsec >= slice_start.nsec) {
+      hdr_record(&hists[TRACE_HIST_SLICE], e->nsec - slice_start.nsec);
+      if (trace_file)
+        write_complete("slice", e->slice, thread, slice_start.nsec, e->nsec);
+    }
+    if (pru_submit.slice == e->slice && e->nsec >= pru_submit.nsec) {
+      hdr_record(&hists[TRACE_HIST_TRANSFER], e->nsec - pru_submit.nsec);
+      if (trace_file)
+        write_complete("transfer", e->slice, PRU_TID, pru_submit.nsec, e->nsec);
+    }
+    break;
+  case TRACE_DEADLINE_MISS:
+    if (trace_file)
+      write_instant("deadline miss", thread, e);
+    break;
+  case TRACE_PANEL_SWAP:
+    if (trace_file)
+      write_instant("panel swap", thread, e);
+    break;
+  case TRACE_ROTATION:
+    if (last_rotation_nsec)
+      hdr_record(&hists[TRACE_HIST_ROTATION], e->nsec - last_rotation_nsec);
+    last_rotation_nsec = e->nsec;
+    if (trace_file)
+      write_instant("rotation", thread, e);
+    break;
+  case TRACE_PANEL_RECEIVED:
+    if (trace_file)
+      write_instant("panel received", thread, e);
+    break;
+  }
+}
+
+void drain_rings() {
+  pthread_mutex_lock(&hist_lock);
+  for (int t = 0; t < TRACE_NUM_THREADS; t++) {
+    trace_ring_t *ring = &trace_rings[t];
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = ring->tail;
+
+    while (tail != head) {
+      process_event(t, &ring->events[tail & (TRACE_RING_SIZE - 1)]);
+      tail++;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&hist_lock);
+}
+
+void print_summary() {
+  printf("Trace summary (usec): %-9s %9s %9s %9s %9s %9s\n", "", "count", "p50", "p99", "p99.9", "max");
+  for (int h = 0; h < TRACE_NUM_HISTS; h++) {
+    const hdr_hist_t *hist = &hists[h];
+    printf("                      %-9s %9" PRIu64 " %9.1f %9.1f %9.1f %9.1f\n", trace_hist_names[h], hist->count,
+        hdr_percentile(hist, 50) / 1000.0, hdr_percentile(hist, 99) / 1000.0,
+        hdr_percentile(hist, 99.9) / 1000.0, hist->max / 1000.0);
+  }
+  printf("Deadline misses: %" PRIu64 ", dropped events:", event_counts[TRACE_DEADLINE_MISS]);
+  for (int t = 0; t < TRACE_NUM_THREADS; t++)
+    printf(" %s %" PRIu32, trace_thread_names[t], trace_rings[t].dropped);
+  printf("\n");
+}
+
+void *trace_func() {
+  trace_start_nsec = trace_now();
+
+  while (keepalive) {
+    usleep(TRACE_POLL_USEC);
+    drain_rings();
+  }
+  drain_rings();
+
+  if (trace_file) {
+    // a final event without a trailing comma closes the array
+    fprintf(trace_file, "{\"name\":\"end\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":%.3f}\n]\n",
+        trace_usec(trace_now()));
+    fclose(trace_file);
+  }
+  print_summary();
+
+  printf("Exiting trace thread\n");
+  return NULL;
+}
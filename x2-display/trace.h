@@ -0,0 +1,128 @@
+#ifndef _trace_h_
+#define _trace_h_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+#include "constants.h"
+
+
+/*
+ * Low overhead event tracing.
+ *
+ * Each traced thread owns a single-producer ring of events, so recording is a
+ * clock read, a 16 byte store and a release store of the head index, with no
+ * locks or read-modify-write atomics.  If the reader falls behind, events are
+ * dropped and counted rather than blocking the producer.
+ *
+ * trace_func() drains the rings, aggregates them into histograms, and writes
+ * them as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) when enabled.
+ */
+
+#define TRACE_RING_SIZE 8192  // events per thread, a power of two
+
+typedef enum {
+  TRACE_DRAWING,
+  TRACE_TIMING,
+  TRACE_SERVER,
+  TRACE_NUM_THREADS
+} trace_thread_t;
+
+typedef enum {
+  TRACE_SLICE_START,     // value: nsec late against the slice schedule
+  TRACE_PRU_SUBMIT,
+  TRACE_RENDER_DONE,     // the next slice is rendered
+  TRACE_PRU_DONE,
+  TRACE_DEADLINE_MISS,   // value: nsec past the end of the slice
+  TRACE_PANEL_SWAP,      // a new panel is being drawn
+  TRACE_ROTATION,        // hall sensor fired
+  TRACE_PANEL_RECEIVED,  // value: bytes received, 0 for a cached panel
+  TRACE_NUM_EVENTS
+} trace_event_type_t;
+
+typedef struct {
+  uint64_t nsec;
+  uint16_t type;
+  uint16_t slice;
+  uint32_t value;
+} trace_event_t;
+
+typedef struct {
+  // producer side
+  uint32_t head __attribute__((aligned(CACHE_LINE_SIZE)));
+  uint32_t cached_tail;
+  uint32_t dropped;
+
+  // consumer side
+  uint32_t tail __attribute__((aligned(CACHE_LINE_SIZE)));
+
+  trace_event_t events[TRACE_RING_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+} trace_ring_t;
+
+
+/*
+ * Log-linear ("HDR") histogram of nanosecond durations: 16 sub-buckets per
+ * power of two, so any recorded value is known to within 1/16th.
+ */
+#define HDR_SUB_BITS 4
+#define HDR_SUB_BUCKETS (1 << HDR_SUB_BITS)
+#define HDR_BUCKETS ((64 - HDR_SUB_BITS + 1) * HDR_SUB_BUCKETS)
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint32_t buckets[HDR_BUCKETS];
+} hdr_hist_t;
+
+typedef enum {
+  TRACE_HIST_SLICE,      // slice start to PRU done
+  TRACE_HIST_SUBMIT,     // slice start to the PRU accepting the frame
+  TRACE_HIST_RENDER,     // rendering the next slice during the transfer
+  TRACE_HIST_TRANSFER,   // PRU submit to PRU done
+  TRACE_HIST_JITTER,     // lateness of slice starts
+  TRACE_HIST_ROTATION,   // rotation period
+  TRACE_NUM_HISTS
+} trace_hist_t;
+
+
+extern trace_ring_t trace_rings[TRACE_NUM_THREADS];
+extern const char *trace_hist_names[TRACE_NUM_HISTS];
+
+
+static inline uint64_t trace_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * NSEC_PER_SECOND + ts.tv_nsec;
+}
+
+static inline void trace_event(trace_thread_t thread, trace_event_type_t type, unsigned int slice, uint32_t value) {
+  trace_ring_t *ring = &trace_rings[thread];
+  uint32_t head = ring->head;
+
+  if (head - ring->cached_tail >= TRACE_RING_SIZE) {
+    ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - ring->cached_tail >= TRACE_RING_SIZE) {
+      ring->dropped++;
+      return;
+    }
+  }
+
+  trace_event_t *e = &ring->events[head & (TRACE_RING_SIZE - 1)];
+  e->nsec = trace_now();
+  e->type = type;
+  e->slice = slice;
+  e->value = value;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+extern void trace_open(const char *path);
+extern void *trace_func();
+extern void trace_histograms(hdr_hist_t *hists);
+extern uint64_t hdr_percentile(const hdr_hist_t *hist, double pct);
+extern uint64_t hdr_count_le(const hdr_hist_t *hist, uint64_t value);
+
+
+#endif
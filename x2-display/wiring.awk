@@ -0,0 +1,86 @@
+# Generates the GPIO setup and the firmware's pin definitions from
+# wiring.conf:
+#
+#   awk -v format=c -f wiring.awk wiring.conf > wiring.h
+#   awk -v format=pasm -f wiring.awk wiring.conf > wiring.hp
+#
+# Lanes 0 to 15 must be on GPIO0 and 16 to 23 on GPIO1, in order, as the
+# firmware reads them.
+
+function fail(msg) {
+	printf("wiring.conf:%d: %s\n", NR, msg) > "/dev/stderr"
+	failed = 1
+	exit 1
+}
+
+{ sub(/#.*/, "") }
+NF == 0 { next }
+
+{
+	if (NF != 4)
+		fail("expected lane, gpio, pin and strip")
+	lane = $1; bank = $2; pin = $3; strip = $4
+	if (bank !~ /^[0-3]$/ || pin !~ /^[0-9]+$/ || pin > 31)
+		fail("no GPIO" bank " pin " pin)
+	if (strip !~ /^([0-9]+|-)$/)
+		fail("bad strip " strip)
+
+	if (lane != "-") {
+		if (lane != num_lanes)
+			fail("lanes must be in order from 0")
+		if (bank != (lane < 16 ? 0 : 1))
+			fail("lane " lane " must be on GPIO" (lane < 16 ? 0 : 1))
+		lane_strip[num_lanes++] = strip
+	}
+	if (lane == "-" && strip != "-")
+		fail("a spare pin cannot drive a strip")
+
+	bit[bank, num_bits[bank]++] = pin
+	mask[bank] += 2 ^ pin
+	pins[num_pins++] = "{ " bank ", " pin " }"
+}
+
+END {
+	if (failed)
+		exit 1
+
+	# invert lane to strip into the strip map
+	num_strips = 0
+	for (i = 0; i < num_lanes; i++) {
+		if (lane_strip[i] == "-")
+			continue
+		if (lane_strip[i] in strip_lane) {
+			printf("wiring.conf: strip %s is on two lanes\n", lane_strip[i]) > "/dev/stderr"
+			exit 1
+		}
+		strip_lane[lane_strip[i]] = i
+		num_strips++
+	}
+
+	print "// Generated from wiring.conf by wiring.awk; do not edit."
+	if (format == "c") {
+		print ""
+		print "#define WIRING_NUM_LANES " num_lanes
+		line = "#define WIRING_PINS"
+		for (i = 0; i < num_pins; i++)
+			line = line (i ? ", " : " ") pins[i]
+		print line
+		line = "#define WIRING_STRIP_MAP"
+		for (s = 0; s < num_strips; s++) {
+			if (!(s in strip_lane)) {
+				printf("wiring.conf: no lane drives strip %d\n", s) > "/dev/stderr"
+				exit 1
+			}
+			line = line (s ? ", " : " ") strip_lane[s]
+		}
+		print line
+	} else {
+		for (b = 0; b < 4; b++) {
+			print ""
+			for (i = 0; i < num_bits[b]; i++)
+				printf("#define gpio%d_bit%d %d\n", b, i, bit[b, i])
+			# in halves, since some awks print %x through a signed int
+			printf("#define GPIO%d_LED_MASK 0x%04x%04x\n", b, int(mask[b] / 65536), mask[b] % 65536)
+		}
+	}
+}
@@ -14,11 +14,8 @@
  //*  1 is 0.60 usec high, 0.65 usec low
  //*  Reset is 50 usec
  //
- // Pins are not contiguous.
- // 16 pins on GPIO0: 2 3 8 9 7 10 11 14 15 20 22 23 26 27 30 31
- // 10 pins on GPIO1: 12 13 14 15 16 17 18 19 28 29
- //  5 pins on GPIO2: 1 2 3 4 5
- //  8 pins on GPIO3: 14 15 16 17 18 19 20 21
+ // Pins are not contiguous; see wiring.conf.
+ // 16 lanes on GPIO0, 8 on GPIO1
  //
  // each pixel is stored in 4 bytes in the order GRBA (4th byte is ignored)
  //
@@ -45,98 +42,9 @@
  //*
  //*/
 
-// Pins available in GPIO0
-#define gpio0_bit0 2
-#define gpio0_bit1 3
-#define gpio0_bit2 8
-#define gpio0_bit3 9
-#define gpio0_bit4 7
-#define gpio0_bit5 10
-#define gpio0_bit6 11
-#define gpio0_bit7 14
-#define gpio0_bit8 15
-#define gpio0_bit9 20
-#define gpio0_bit10 22
-#define gpio0_bit11 23
-#define gpio0_bit12 26
-#define gpio0_bit13 27
-#define gpio0_bit14 30
-#define gpio0_bit15 31
-
-// Pins available in GPIO1
-#define gpio1_bit0 12
-#define gpio1_bit1 13
-#define gpio1_bit2 14
-#define gpio1_bit3 15
-#define gpio1_bit4 16
-#define gpio1_bit5 17
-#define gpio1_bit6 18
-#define gpio1_bit7 19
-#define gpio1_bit8 28
-#define gpio1_bit9 29
-
-// Pins in GPIO2
-#define gpio2_bit0 1
-#define gpio2_bit1 2
-#define gpio2_bit2 3
-#define gpio2_bit3 4
-#define gpio2_bit4 5
-
-// And the paltry pins in GPIO3 to give us 32
-#define gpio3_bit0 16
-#define gpio3_bit1 19
-
-/** Generate a bitmask of which pins in GPIO0-3 are used.
- *
- * This is used to bring all the pins up for the start of
- * the bit, and then back down at the end of the 1 bits.
- *
- * \todo wtf "parameter too long": only 128 chars allowed?
- */
-#define GPIO0_LED_MASK (0\
-|(1<<gpio0_bit0)\
-|(1<<gpio0_bit1)\
-|(1<<gpio0_bit2)\
-|(1<<gpio0_bit3)\
-|(1<<gpio0_bit4)\
-|(1<<gpio0_bit5)\
-|(1<<gpio0_bit6)\
-|(1<<gpio0_bit7)\
-|(1<<gpio0_bit8)\
-|(1<<gpio0_bit9)\
-|(1<<gpio0_bit10)\
-|(1<<gpio0_bit11)\
-|(1<<gpio0_bit12)\
-|(1<<gpio0_bit13)\
-|(1<<gpio0_bit14)\
-|(1<<gpio0_bit15)\
-)
-
-#define GPIO1_LED_MASK (0\
-|(1<<gpio1_bit0)\
-|(1<<gpio1_bit1)\
-|(1<<gpio1_bit2)\
-|(1<<gpio1_bit3)\
-|(1<<gpio1_bit4)\
-|(1<<gpio1_bit5)\
-|(1<<gpio1_bit6)\
-|(1<<gpio1_bit7)\
-|(1<<gpio1_bit8)\
-|(1<<gpio1_bit9)\
-)
-
-#define GPIO2_LED_MASK (0\
-|(1<<gpio2_bit0)\
-|(1<<gpio2_bit1)\
-|(1<<gpio2_bit2)\
-|(1<<gpio2_bit3)\
-|(1<<gpio2_bit4)\
-)
-
-#define GPIO3_LED_MASK (0\
-|(1<<gpio3_bit0)\
-|(1<<gpio3_bit1)\
-)
+// The pins of each lane, gpioN_bitM, and the masks of the pins used on
+// each bank, GPION_LED_MASK, are generated from wiring.conf.
+#include "wiring.hp"
 
 .origin 0
 .entrypoint START
@@ -163,6 +71,22 @@
 #define bit_num r6
 #define sleep_counter r7
 // r10 - r26 are used for temp storage and bitmap processing
+#define load_cycles r27
+#define bit_cycles r28
+#define overruns r29
+
+/** Frame statistics published after the command structure in PRU DRAM.
+ * frames, load_cycles, bit_cycles, reset_cycles, overruns; see
+ * ws281x_command_t in ledscape.c.
+ */
+#define STATS_OFFSET 16
+
+/** Cycles the idle part of a bit leaves for loading and slicing data */
+#ifdef CONFIG_WS2812
+#define LOAD_BUDGET_CYCLES (2*650/5)
+#else
+#define LOAD_BUDGET_CYCLES (650/5)
+#endif
 
 
 /** Sleep a given number of nanoseconds with 10 ns resolution.
@@ -247,6 +171,11 @@ _LOOP:
     // Command of 0xFF is the signal to exit
     QBEQ EXIT, r2, #0xFF
 
+    // Start this frame's statistics
+    MOV load_cycles, 0
+    MOV bit_cycles, 0
+    MOV overruns, 0
+
 WORD_LOOP:
 	// for bit in 24 to 0
 	MOV bit_num, 24
@@ -346,6 +275,16 @@ WORD_LOOP:
 		MOV r22, GPIO2_LED_MASK
 		MOV r23, GPIO3_LED_MASK
 
+		// Account for the time spent loading and slicing, and
+		// count the bit as an overrun if it has eaten into the
+		// high part of the bit.
+		LBBO r9, r8, 0xC, 4
+		ADD load_cycles, load_cycles, r9
+		MOV r8, LOAD_BUDGET_CYCLES
+		QBGT no_overrun, r9, r8
+		ADD overruns, overruns, 1
+no_overrun:
+
 		// Wait for 650 ns to have passed
 		// \todo: Move some of the other work to the other
 		// cycles.  I think this might have already been exhausted
@@ -384,6 +323,10 @@ WORD_LOOP:
 //		SBBO r22, r12, 0, 4
 //		SBBO r23, r13, 0, 4
 
+		// Account for the whole bit, load included
+		LBBO r9, r8, 0xC, 4
+		ADD bit_cycles, bit_cycles, r9
+
 		QBNE BIT_LOOP, bit_num, 0
 
 	// The 32 RGB streams have been clocked out
@@ -392,16 +335,35 @@ WORD_LOOP:
 	SUB data_len, data_len, 1
 	QBNE WORD_LOOP, data_len, #0
 
+    // Restart the cycle counter to time the reset
+    MOV r8, 0x22000 // control register
+    LBBO r9, r8, 0, 4
+    CLR r9, r9, 3 // disable counter bit
+    SBBO r9, r8, 0, 4
+    MOV r10, 0
+    SBBO r10, r8, 0xC, 4 // clear the timer
+    SET r9, r9, 3 // enable counter bit
+    SBBO r9, r8, 0, 4
+
     // Delay at least 50 usec; this is the required reset
     // time for the LED strip to update with the new pixels.
     SLEEPNS 50000, 1, reset_time
 
+    // Publish the frame statistics before the response, so that
+    // they are complete by the time the ARM sees we are done:
+    // r10 = frames, r11 = load, r12 = bit, r13 = reset, r14 = overruns
+    LBBO r13, r8, 0xC, 4
+    LBCO r10, CONST_PRUDRAM, STATS_OFFSET, 4
+    ADD r10, r10, 1
+    MOV r11, load_cycles
+    MOV r12, bit_cycles
+    MOV r14, overruns
+    SBCO r10, CONST_PRUDRAM, STATS_OFFSET, 5*4
+
     // Write out that we are done!
-    // Store a non-zero response in the buffer so that they know that we are done
-    // aso a quick hack, we write the counter so that we know how
-    // long it took to write out.
-    MOV r8, 0x22000 // control register
-    LBBO r2, r8, 0xC, 4
+    // Store a non-zero response in the buffer so that they know that we are done:
+    // the total cycles the frame took to clock out and latch.
+    ADD r2, r12, r13
     SBCO r2, CONST_PRUDRAM, 12, 4
 
     // Go back to waiting for the next frame buffer
@@ -0,0 +1,278 @@
+/*
+ * Load generator for the x2-display server protocols.
+ *
+ * Sends count messages of one kind and reports messages and bytes per
+ * second.  Framed modes keep window requests in flight on one connection;
+ * legacy mode opens a connection per panel, as clients did before the framed
+ * protocol.
+ *
+ * usage: x2-bench [-m mode] [-n count] [-w window] [-s bytes] <host> <port>
+ *
+ *   -m  ping, panel, show, stats, settings or legacy (default ping); show
+ *       stores one panel in the server's cache, then shows it by id
+ *   -n  messages to send (default 10000)
+ *   -w  requests in flight (default 32)
+ *   -s  payload bytes for ping and panel (default 0 for ping, one
+ *       224 x 102 BRGA panel otherwise)
+ */
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "constants.h"
+#include "protocol.h"
+
+
+#define DEFAULT_COUNT 10000
+#define DEFAULT_WINDOW 32
+#define DEFAULT_PANEL_SIZE (224 * 102 * 4)
+
+
+const char *host;
+const char *port;
+uint64_t panel_id;
+
+
+void die(const char *msg) {
+  perror(msg);
+  exit(1);
+}
+
+uint64_t gettime() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t) tv.tv_sec * USEC_PER_SECOND + tv.tv_usec;
+}
+
+int connect_server() {
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+  struct addrinfo *addrs;
+  int rc = getaddrinfo(host, port, &hints, &addrs);
+  if (rc != 0) {
+    fprintf(stderr, "%s: %s\n", host, gai_strerror(rc));
+    exit(1);
+  }
+
+  int fd = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+  if (fd < 0 || connect(fd, addrs->ai_addr, addrs->ai_addrlen) < 0)
+    die("connect");
+  freeaddrinfo(addrs);
+  return fd;
+}
+
+void write_all(int fd, const uint8_t *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n <= 0)
+      die("write");
+    buf += n;
+    len -= n;
+  }
+}
+
+void read_all(int fd, uint8_t *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, buf, len);
+    if (n <= 0)
+      die("read");
+    buf += n;
+    len -= n;
+  }
+}
+
+void hello(int fd) {
+  uint8_t buf[X2_HELLO_SIZE];
+  memcpy(buf, X2_PROTOCOL_MAGIC, 4);
+  put_u16(buf + 4, X2_PROTOCOL_VERSION);
+  put_u16(buf + 6, 0);
+  write_all(fd, buf, sizeof(buf));
+
+  read_all(fd, buf, sizeof(buf));
+  if (memcmp(buf, X2_PROTOCOL_MAGIC, 4) != 0) {
+    fprintf(stderr, "server does not speak the framed protocol\n");
+    exit(1);
+  }
+}
+
+// build the request for message i into buf, and return its size
+size_t build_request(uint8_t *buf, const char *mode, unsigned int i, const uint8_t *payload, uint32_t size) {
+  uint16_t type;
+  uint32_t len = 0;
+  uint8_t *p = buf + X2_HEADER_SIZE;
+
+  if (strcmp(mode, "ping") == 0) {
+    type = X2_MSG_PING;
+    len = size;
+    memcpy(p, payload, size);
+  } else if (strcmp(mode, "panel") == 0) {
+    type = X2_MSG_PANEL;
+    len = size;
+    memcpy(p, payload, size);
+  } else if (strcmp(mode, "show") == 0) {
+    type = X2_MSG_PANEL_SHOW;
+    len = 8;
+    put_u64(p, panel_id);
+  } else if (strcmp(mode, "stats") == 0) {
+    type = X2_MSG_STATS;
+  } else {
+    type = X2_MSG_X_OFFSET;
+    len = 4;
+    put_u32(p, i % 224);
+  }
+
+  put_u32(buf, len);
+  put_u16(buf + 4, type);
+  put_u16(buf + 6, i);
+  return X2_HEADER_SIZE + len;
+}
+
+uint64_t run_framed(const char *mode, unsigned int count, unsigned int window, uint32_t size) {
+  int fd = connect_server();
+  hello(fd);
+
+  uint8_t *payload = calloc(1, size + 1);
+  uint8_t *request = malloc(X2_HEADER_SIZE + (size > 8 ? size : 8));
+  uint8_t *reply = malloc(X2_HEADER_SIZE + X2_MAX_SMALL_PAYLOAD + size);
+  if (payload == NULL || request == NULL || reply == NULL)
+    die("malloc");
+
+  if (strcmp(mode, "show") == 0) {
+    // store the panel once, outside the timed messages
+    put_u32(request, size);
+    put_u16(request + 4, X2_MSG_PANEL_STORE);
+    put_u16(request + 6, 0);
+    memcpy(request + X2_HEADER_SIZE, payload, size);
+    write_all(fd, request, X2_HEADER_SIZE + size);
+    read_all(fd, reply, X2_HEADER_SIZE);
+    if (get_u16(reply + 4) != (X2_MSG_PANEL_STORE | X2_MSG_REPLY)) {
+      fprintf(stderr, "could not store panel\n");
+      exit(1);
+    }
+    read_all(fd, reply + X2_HEADER_SIZE, 8);
+    panel_id = get_u64(reply + X2_HEADER_SIZE);
+  }
+
+  uint64_t bytes = 0;
+  unsigned int sent = 0;
+  unsigned int received = 0;
+  while (received < count) {
+    // fill the window, then take one reply before sending more
+    while (sent < count && sent - received < window) {
+      size_t len = build_request(request, mode, sent, payload, size);
+      write_all(fd, request, len);
+      bytes += len;
+      sent++;
+    }
+
+    read_all(fd, reply, X2_HEADER_SIZE);
+    uint32_t len = get_u32(reply);
+    uint16_t type = get_u16(reply + 4);
+    uint16_t seq = get_u16(reply + 6);
+    if (len > X2_MAX_SMALL_PAYLOAD + size) {
+      fprintf(stderr, "reply too long: %" PRIu32 "\n", len);
+      exit(1);
+    }
+    read_all(fd, reply + X2_HEADER_SIZE, len);
+    if (type == X2_MSG_ERROR) {
+      fprintf(stderr, "error: %.*s\n", (int) len, reply + X2_HEADER_SIZE);
+      exit(1);
+    }
+    if (seq != (uint16_t) received) {
+      fprintf(stderr, "reply %u out of order: %u\n", received, seq);
+      exit(1);
+    }
+    received++;
+  }
+
+  free(payload);
+  free(request);
+  free(reply);
+  close(fd);
+  return bytes;
+}
+
+uint64_t run_legacy(unsigned int count, uint32_t size) {
+  uint8_t *request = calloc(1, 5 + size);
+  if (request == NULL)
+    die("calloc");
+  request[0] = '0';
+  uint32_t pixels = size / 4;
+  request[1] = pixels >> 24;
+  request[2] = pixels >> 16;
+  request[3] = pixels >> 8;
+  request[4] = pixels;
+
+  for (unsigned int i = 0; i < count; i++) {
+    int fd = connect_server();
+    write_all(fd, request, 5 + size);
+    // the server closes once the panel is in
+    uint8_t c;
+    while (read(fd, &c, 1) > 0)
+      ;
+    close(fd);
+  }
+
+  free(request);
+  return (uint64_t) count * (5 + size);
+}
+
+void usage(char *name) {
+  fprintf(stderr, "usage: %s [-m ping|panel|show|stats|settings|legacy] [-n count] [-w window] [-s bytes] <host> <port>\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *mode = "ping";
+  unsigned int count = DEFAULT_COUNT;
+  unsigned int window = DEFAULT_WINDOW;
+  int size = -1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "m:n:w:s:")) != -1) {
+    switch (opt) {
+    case 'm':
+      mode = optarg;
+      break;
+    case 'n':
+      count = atoi(optarg);
+      break;
+    case 'w':
+      window = atoi(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 2 || window < 1)
+    usage(argv[0]);
+  host = argv[optind];
+  port = argv[optind + 1];
+
+  bool legacy = strcmp(mode, "legacy") == 0;
+  if (!legacy && strcmp(mode, "ping") && strcmp(mode, "panel") && strcmp(mode, "show") && strcmp(mode, "stats") && strcmp(mode, "settings"))
+    usage(argv[0]);
+  if (size < 0)
+    size = strcmp(mode, "ping") == 0 ? 0 : DEFAULT_PANEL_SIZE;
+  if (strcmp(mode, "ping") == 0 && size > X2_MAX_SMALL_PAYLOAD) {
+    fprintf(stderr, "ping payloads are at most %d bytes\n", X2_MAX_SMALL_PAYLOAD);
+    exit(1);
+  }
+
+  uint64_t start_usec = gettime();
+  uint64_t bytes = legacy ? run_legacy(count, size) : run_framed(mode, count, window, size);
+  double secs = (double) (gettime() - start_usec) / USEC_PER_SECOND;
+
+  printf("%s: %u messages in %.3f s, %.0f messages/s, %.1f MB/s\n",
+      mode, count, secs, count / secs, bytes / secs / 1e6);
+  return 0;
+}
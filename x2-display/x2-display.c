@@ -3,15 +3,35 @@
  * Listens on a specified port for image data, and displays that data to the
  * Orbital Rendersphere POV display.
  *
- * usage: x2-display <port>
+ * usage: x2-display [-f config-file] [-c capture-file] [-t trace-file] [-a animation-file]
+ *                   [-r record-file] [port]
+ *
+ *   -f  read settings from config-file instead of ./x2-display.conf
+ *   -c  record every frame sent to the LEDs, for x2-preview
+ *   -t  write a Chrome trace (JSON) of slice timing to trace-file
+ *   -a  loop the animation in animation-file (see x2-pack)
+ *   -r  record every message received to record-file, for x2-replay
  */
 
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include "capture.h"
+#include "cluster.h"
+#include "config.h"
 #include "drawing.h"
+#include "effects.h"
+#include "geometry.h"
+#include "metrics.h"
+#include "panel-cache.h"
+#include "playback.h"
+#include "realtime.h"
+#include "recorder.h"
+#include "resample.h"
 #include "timing.h"
+#include "trace.h"
 #include "x2-server.h"
 
 
@@ -23,42 +43,138 @@ void INThandler() {
   keepalive = false;
 }
 
+void HUPhandler() {
+  reload = true;
+}
+
+
+void usage(char *name) {
+  fprintf(stderr, "usage: %s [-f config-file] [-c capture-file] [-t trace-file] [-a animation-file] [-r record-file] [port]\n", name);
+  exit(1);
+}
+
 
 int main(int argc, char **argv) {
   int port = DEFAULT_PORT;
+  char *config_path = NULL;
+  char *capture_path = NULL;
+  char *trace_path = NULL;
+  const char *animation_path = NULL;
+  char *record_path = NULL;
 
   // check command line args
-  if (argc == 1) {
-    port = DEFAULT_PORT;
-  } else if (argc == 2) {
-    port = atoi(argv[1]);
+  int opt;
+  while ((opt = getopt(argc, argv, "f:c:t:a:r:")) != -1) {
+    switch (opt) {
+    case 'f':
+      config_path = optarg;
+      break;
+    case 'c':
+      capture_path = optarg;
+      break;
+    case 't':
+      trace_path = optarg;
+      break;
+    case 'a':
+      animation_path = optarg;
+      break;
+    case 'r':
+      record_path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind == argc - 1) {
+    port = atoi(argv[optind]);
+  } else if (optind != argc) {
+    usage(argv[0]);
+  }
+
+  // read configuration; the default file is optional
+  if (config_path) {
+    if (!config_load(config_path)) {
+      perror(config_path);
+      exit(1);
+    }
   } else {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
-    exit(1);
+    config_load(DEFAULT_CONFIG_PATH);
   }
 
   // initialize
+  geometry_init();
   drawing_init();
   timing_init();
+  metrics_init();
+  panel_cache_init();
+  cluster_init();
+  resample_init();
+  effects_init();
+  if (capture_path)
+    capture_open(capture_path);
+  if (trace_path)
+    trace_open(trace_path);
+  if (animation_path == NULL)
+    animation_path = config_string("animation", NULL);
+  if (animation_path)
+    playback_open(animation_path);
+  if (record_path)
+    recorder_open(record_path);
+  realtime_init();
+  realtime_selftest();
 
   signal(SIGINT, INThandler);
+  signal(SIGHUP, HUPhandler);
+  signal(SIGPIPE, SIG_IGN);  // a client hanging up is not fatal
   pthread_mutex_init(&lock, NULL);
 
+  // start trace thread
+  pthread_t trace_thread;
+  pthread_create(&trace_thread, NULL, trace_func, NULL);
+  realtime_thread(trace_thread, "trace");
+
+  // start metrics thread
+  pthread_t metrics_thread;
+  pthread_create(&metrics_thread, NULL, metrics_func, NULL);
+  realtime_thread(metrics_thread, "metrics");
+
+  // start playback thread
+  pthread_t playback_thread;
+  pthread_create(&playback_thread, NULL, playback_func, NULL);
+  realtime_thread(playback_thread, "playback");
+
+  // start effects thread
+  pthread_t effects_thread;
+  pthread_create(&effects_thread, NULL, effects_func, NULL);
+  realtime_thread(effects_thread, "effects");
+
   // start timing thread
   pthread_t timing_thread;
   pthread_create(&timing_thread, NULL, timing_func, NULL);
+  realtime_thread(timing_thread, "timing");
 
   // start drawing thread
   pthread_t drawing_thread;
   pthread_create(&drawing_thread, NULL, drawing_func, NULL);
+  realtime_thread(drawing_thread, "drawing");
 
   // start server on main thread
+  realtime_thread(pthread_self(), "server");
   server_func(port);
+  cluster_close();
 
   // shutdown
   printf("Waiting for other threads to complete\n");
   pthread_join(timing_thread, NULL);
   pthread_join(drawing_thread, NULL);
+  pthread_join(trace_thread, NULL);
+  pthread_join(metrics_thread, NULL);
+  pthread_join(playback_thread, NULL);
+  pthread_join(effects_thread, NULL);
+  playback_close();
+  effects_close();
+  recorder_close();
+  capture_close();
 
   printf("Program completed. Exiting.\n");
   pthread_exit(NULL);
@@ -0,0 +1,231 @@
+/*
+ * Packs a sequence of images into an animation file for x2-display -a.
+ *
+ * The images are binary PPMs (P6, maxval 255) the size of a panel, e.g. the
+ * 224x102 equirectangular images x2-preview writes.  Frames are run-length
+ * encoded where that makes them smaller, and stored raw at page aligned
+ * offsets otherwise.
+ *
+ * usage: x2-pack [-d msec] [-r] <animation-file> <image.ppm>...
+ *
+ *   -d  how long each frame is shown (default 40 msec)
+ *   -r  store every frame raw, for the least decoding work on playback
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "animation.h"
+
+
+#define DEFAULT_DURATION_MSEC 40
+#define PIXEL_SIZE 4
+
+
+unsigned int width;
+unsigned int height;
+
+
+void die(const char *msg) {
+  perror(msg);
+  exit(1);
+}
+
+// skip whitespace and comments in a PPM header, then read a number
+unsigned int read_ppm_number(FILE *f, const char *path) {
+  int c = fgetc(f);
+  while (c == '#' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+    if (c == '#')
+      while (c != '\n' && c != EOF)
+        c = fgetc(f);
+    c = fgetc(f);
+  }
+  ungetc(c, f);
+
+  unsigned int n;
+  if (fscanf(f, "%u", &n) != 1) {
+    fprintf(stderr, "%s: bad PPM header\n", path);
+    exit(1);
+  }
+  return n;
+}
+
+// read a PPM into a panel, allocated once the first image sets the size
+uint8_t *read_panel(const char *path, uint8_t *panel) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+    die(path);
+
+  char magic[3] = { 0 };
+  if (fread(magic, 1, 2, f) != 2 || strcmp(magic, "P6") != 0) {
+    fprintf(stderr, "%s: not a binary PPM\n", path);
+    exit(1);
+  }
+  unsigned int w = read_ppm_number(f, path);
+  unsigned int h = read_ppm_number(f, path);
+  unsigned int maxval = read_ppm_number(f, path);
+  fgetc(f);
+  if (maxval != 255) {
+    fprintf(stderr, "%s: only 8 bit PPMs are supported\n", path);
+    exit(1);
+  }
+
+  if (panel == NULL) {
+    width = w;
+    height = h;
+    panel = malloc(width * height * PIXEL_SIZE);
+    if (panel == NULL)
+      die("malloc");
+  } else if (w != width || h != height) {
+    fprintf(stderr, "%s: %ux%u, but the first image is %ux%u\n", path, w, h, width, height);
+    exit(1);
+  }
+
+  // panels are stored as in x2-display: the colour in bytes 1 to 3
+  for (unsigned int i = 0; i < width * height; i++) {
+    uint8_t rgb[3];
+    if (fread(rgb, 1, 3, f) != 3) {
+      fprintf(stderr, "%s: truncated\n", path);
+      exit(1);
+    }
+    panel[i * PIXEL_SIZE] = 0;
+    panel[i * PIXEL_SIZE + 1] = rgb[0];
+    panel[i * PIXEL_SIZE + 2] = rgb[1];
+    panel[i * PIXEL_SIZE + 3] = rgb[2];
+  }
+
+  fclose(f);
+  return panel;
+}
+
+bool same_pixel(const uint8_t *a, const uint8_t *b) {
+  return memcmp(a, b, PIXEL_SIZE) == 0;
+}
+
+// run-length encode a panel into out, and return the encoded length
+size_t rle_encode(uint8_t *out, const uint8_t *panel, size_t num_pixels) {
+  size_t len = 0;
+  size_t i = 0;
+
+  while (i < num_pixels) {
+    // a run of at least 2 repeated pixels
+    size_t run = 1;
+    while (i + run < num_pixels && run < RLE_MAX_RUN &&
+        same_pixel(panel + (i + run) * PIXEL_SIZE, panel + i * PIXEL_SIZE))
+      run++;
+    if (run >= 2) {
+      out[len++] = run + 126;
+      memcpy(out + len, panel + i * PIXEL_SIZE, PIXEL_SIZE);
+      len += PIXEL_SIZE;
+      i += run;
+      continue;
+    }
+
+    // literals, up to the next pair of repeated pixels
+    size_t lit = 1;
+    while (i + lit < num_pixels && lit < RLE_MAX_LITERAL &&
+        !(i + lit + 1 < num_pixels &&
+          same_pixel(panel + (i + lit) * PIXEL_SIZE, panel + (i + lit + 1) * PIXEL_SIZE)))
+      lit++;
+    out[len++] = lit - 1;
+    memcpy(out + len, panel + i * PIXEL_SIZE, lit * PIXEL_SIZE);
+    len += lit * PIXEL_SIZE;
+    i += lit;
+  }
+
+  return len;
+}
+
+void usage(char *name) {
+  fprintf(stderr, "usage: %s [-d msec] [-r] <animation-file> <image.ppm>...\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  unsigned int duration_msec = DEFAULT_DURATION_MSEC;
+  bool raw = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "d:r")) != -1) {
+    switch (opt) {
+    case 'd':
+      duration_msec = atoi(optarg);
+      break;
+    case 'r':
+      raw = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (argc - optind < 2 || duration_msec == 0)
+    usage(argv[0]);
+
+  const char *path = argv[optind];
+  char **images = argv + optind + 1;
+  uint32_t num_frames = argc - optind - 1;
+
+  FILE *f = fopen(path, "wb");
+  if (f == NULL)
+    die(path);
+
+  animation_frame_t *index = calloc(num_frames, sizeof(animation_frame_t));
+  if (index == NULL)
+    die("calloc");
+
+  // frames start after the header and index, which are written last
+  uint64_t offset = sizeof(animation_header_t) + (uint64_t) num_frames * sizeof(animation_frame_t);
+  uint8_t *panel = NULL;
+  uint8_t *encoded = NULL;
+  uint64_t raw_frames = 0;
+
+  for (uint32_t i = 0; i < num_frames; i++) {
+    panel = read_panel(images[i], panel);
+    size_t panel_size = width * height * PIXEL_SIZE;
+    if (encoded == NULL) {
+      // worst case: a control byte per literal run
+      encoded = malloc(panel_size + panel_size / (RLE_MAX_LITERAL * PIXEL_SIZE) + 1);
+      if (encoded == NULL)
+        die("malloc");
+    }
+
+    size_t len = raw ? panel_size : rle_encode(encoded, panel, width * height);
+    const uint8_t *data = encoded;
+    if (len >= panel_size) {
+      len = panel_size;
+      data = panel;
+      offset = (offset + ANIMATION_ALIGN - 1) & ~(uint64_t) (ANIMATION_ALIGN - 1);
+      raw_frames++;
+    }
+
+    index[i].offset = offset;
+    index[i].length = len;
+    index[i].duration_usec = duration_msec * 1000;
+    if (fseeko(f, offset, SEEK_SET) != 0 || fwrite(data, len, 1, f) != 1)
+      die(path);
+    offset += len;
+  }
+
+  animation_header_t header = {
+    .magic = ANIMATION_MAGIC,
+    .version = ANIMATION_VERSION,
+    .width = width,
+    .height = height,
+    .num_frames = num_frames,
+  };
+  if (fseeko(f, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, f) != 1 ||
+      fwrite(index, sizeof(animation_frame_t), num_frames, f) != num_frames ||
+      fclose(f) != 0)
+    die(path);
+
+  printf("%s: %" PRIu32 " %ux%u frames, %" PRIu64 " raw, %" PRIu64 " bytes\n",
+      path, num_frames, width, height, raw_frames, offset);
+  free(panel);
+  free(encoded);
+  free(index);
+  return 0;
+}
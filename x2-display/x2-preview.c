@@ -0,0 +1,396 @@
+/*
+ * Offline preview of what the Orbital Rendersphere showed, reconstructed from
+ * a capture recorded with x2-display -c.
+ *
+ * For every emitted rotation this writes an equirectangular image of the
+ * sphere surface (<prefix>-eq-NNNNNN.ppm) and a view of the sphere turning a
+ * little further each time (<prefix>-sphere-NNNNNN.ppm).  The capture is
+ * streamed, so arbitrarily long runs use a bounded amount of memory, and the
+ * images are rendered and written by a pool of worker threads.
+ *
+ * usage: x2-preview [-j threads] [-e every] [-t] [-s size] [-d degrees] <capture-file> <out-prefix>
+ *
+ *   -j  worker threads (default: number of CPUs)
+ *   -e  only emit every Nth rotation (default 1)
+ *   -t  place slices by their timestamp rather than their slice index,
+ *       which shows late or drifting slices where they really landed
+ *   -s  size of the sphere view in pixels (default 256)
+ *   -d  degrees the sphere view turns per emitted rotation (default 10)
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "capture.h"
+#include "constants.h"
+
+
+#define READ_BUFSIZE (4 * 1024 * 1024)
+#define DEFAULT_SPHERE_SIZE 256
+#define DEFAULT_DEGREES 10.0
+
+
+typedef struct job {
+  struct job *next;
+  uint32_t rotation;
+  unsigned int emit_idx;
+  uint8_t *equirect;  // RGB, width x height
+} job_t;
+
+
+// capture geometry
+capture_header_t header;
+int lane_strip[256];  // strip index driven by each lane, -1 if unused
+unsigned int width;   // equirect width, one column per slice
+unsigned int height;  // equirect height, one row per pixel along the arms
+unsigned int num_rows;
+
+// options
+const char *prefix;
+unsigned int sphere_size = DEFAULT_SPHERE_SIZE;
+double degrees = DEFAULT_DEGREES;
+
+// sphere view lookup: equirect row and fractional column for each pixel
+int *view_y;
+double *view_x;
+
+// work queue
+pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+job_t *free_jobs;
+job_t *pending_head;
+job_t *pending_tail;
+bool reading_done = false;
+
+
+void die_usage(char *name) {
+  fprintf(stderr, "usage: %s [-j threads] [-e every] [-t] [-s size] [-d degrees] <capture-file> <out-prefix>\n", name);
+  exit(1);
+}
+
+void write_ppm(const char *kind, uint32_t rotation, const uint8_t *rgb, unsigned int w, unsigned int h) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s-%s-%06" PRIu32 ".ppm", prefix, kind, rotation);
+
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  fprintf(f, "P6\n%u %u\n255\n", w, h);
+  fwrite(rgb, 3, w * h, f);
+  fclose(f);
+}
+
+void view_init() {
+  view_y = malloc(sphere_size * sphere_size * sizeof(*view_y));
+  view_x = malloc(sphere_size * sphere_size * sizeof(*view_x));
+
+  for (unsigned int v = 0; v < sphere_size; v++) {
+    for (unsigned int u = 0; u < sphere_size; u++) {
+      unsigned int i = v * sphere_size + u;
+      double nx = (2.0 * u + 1) / sphere_size - 1;
+      double ny = 1 - (2.0 * v + 1) / sphere_size;
+      double r2 = nx * nx + ny * ny;
+      if (r2 > 1) {
+        view_y[i] = -1;  // background
+        continue;
+      }
+
+      // orthographic view of the sphere from the equator
+      double nz = sqrt(1 - r2);
+      double lat = asin(ny);
+      double lon = atan2(nx, nz);
+
+      int y = (0.5 - lat / M_PI) * height;
+      view_y[i] = y < (int) height ? y : (int) height - 1;
+      view_x[i] = (lon / (2 * M_PI) + 1) * width;
+    }
+  }
+}
+
+void render_sphere(const job_t *job, uint8_t *rgb) {
+  double shift = job->emit_idx * degrees / 360 * width;
+
+  for (unsigned int i = 0; i < sphere_size * sphere_size; i++) {
+    uint8_t *out = &rgb[i * 3];
+    if (view_y[i] < 0) {
+      out[0] = out[1] = out[2] = 0;
+      continue;
+    }
+
+    unsigned int x = ((unsigned int) (view_x[i] + shift)) % width;
+    const uint8_t *in = &job->equirect[(view_y[i] * width + x) * 3];
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+  }
+}
+
+void *worker_func() {
+  uint8_t *sphere = malloc(sphere_size * sphere_size * 3);
+
+  while (true) {
+    pthread_mutex_lock(&queue_lock);
+    while (pending_head == NULL && !reading_done)
+      pthread_cond_wait(&queue_cond, &queue_lock);
+    job_t *job = pending_head;
+    if (job != NULL) {
+      pending_head = job->next;
+      if (pending_head == NULL)
+        pending_tail = NULL;
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    if (job == NULL)
+      break;
+
+    write_ppm("eq", job->rotation, job->equirect, width, height);
+    render_sphere(job, sphere);
+    write_ppm("sphere", job->rotation, sphere, sphere_size, sphere_size);
+
+    // hand the buffer back to the reader
+    pthread_mutex_lock(&queue_lock);
+    job->next = free_jobs;
+    free_jobs = job;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+  }
+
+  free(sphere);
+  return NULL;
+}
+
+job_t *get_free_job() {
+  pthread_mutex_lock(&queue_lock);
+  while (free_jobs == NULL)
+    pthread_cond_wait(&queue_cond, &queue_lock);
+  job_t *job = free_jobs;
+  free_jobs = job->next;
+  pthread_mutex_unlock(&queue_lock);
+
+  memset(job->equirect, 0, width * height * 3);
+  return job;
+}
+
+void submit_job(job_t *job) {
+  job->next = NULL;
+  pthread_mutex_lock(&queue_lock);
+  if (pending_tail != NULL)
+    pending_tail->next = job;
+  else
+    pending_head = job;
+  pending_tail = job;
+  pthread_cond_broadcast(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+}
+
+/*
+ * Paint the LED values of one frame onto the equirect image, for every slice
+ * position from start up to (but not including) end.
+ */
+void paint_frame(uint8_t *equirect, const ledscape_frame_t *frame, unsigned int start, unsigned int end) {
+  unsigned int quadrant_width = width / header.strips_per_row;
+
+  for (unsigned int lane = 0; lane < header.num_strips; lane++) {
+    int strip_idx = lane_strip[lane];
+    if (strip_idx < 0)
+      continue;
+
+    unsigned int row = strip_idx / header.strips_per_row;
+    unsigned int col = (header.strips_per_row - strip_idx) % header.strips_per_row;
+
+    for (unsigned int pixel_idx = 0; pixel_idx < header.num_pixels; pixel_idx++) {
+      // same placement as drawing_func, so a correct render reproduces the panel
+      unsigned int y = row * header.num_pixels + (row < num_rows / 2 ? pixel_idx : header.num_pixels - 1 - pixel_idx);
+      const ledscape_pixel_t *p = &frame[pixel_idx].strip[lane];
+
+      for (unsigned int pos = start; pos < end; pos++) {
+        unsigned int x = (width - 1 - ((pos + col * quadrant_width) % width));
+        uint8_t *out = &equirect[(y * width + x) * 3];
+        out[0] = p->r;
+        out[1] = p->g;
+        out[2] = p->b;
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int every = 1;
+  bool by_timestamp = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "j:e:ts:d:")) != -1) {
+    switch (opt) {
+    case 'j': num_threads = atoi(optarg); break;
+    case 'e': every = atoi(optarg); break;
+    case 't': by_timestamp = true; break;
+    case 's': sphere_size = atoi(optarg); break;
+    case 'd': degrees = atof(optarg); break;
+    default: die_usage(argv[0]);
+    }
+  }
+  if (optind != argc - 2 || num_threads == 0 || every == 0 || sphere_size == 0)
+    die_usage(argv[0]);
+  prefix = argv[optind + 1];
+
+  FILE *in = fopen(argv[optind], "rb");
+  if (in == NULL) {
+    perror(argv[optind]);
+    exit(1);
+  }
+  posix_fadvise(fileno(in), 0, 0, POSIX_FADV_SEQUENTIAL);
+  setvbuf(in, NULL, _IOFBF, READ_BUFSIZE);
+
+  // read header and strip map
+  if (fread(&header, sizeof(header), 1, in) != 1
+      || memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0
+      || header.version != CAPTURE_VERSION
+      || header.num_strips == 0 || header.num_strips > 256
+      || header.strips_per_row == 0 || header.num_slices % header.strips_per_row != 0) {
+    fprintf(stderr, "%s: not a valid capture file\n", argv[optind]);
+    exit(1);
+  }
+  for (unsigned int lane = 0; lane < 256; lane++)
+    lane_strip[lane] = -1;
+  for (unsigned int strip_idx = 0; strip_idx < header.num_strips; strip_idx++) {
+    int32_t lane;
+    if (fread(&lane, sizeof(lane), 1, in) != 1) {
+      fprintf(stderr, "%s: truncated strip map\n", argv[optind]);
+      exit(1);
+    }
+    if (lane >= 0 && lane < (int32_t) header.num_strips) {
+      lane_strip[lane] = strip_idx;
+      num_rows = strip_idx / header.strips_per_row + 1;
+    }
+  }
+
+  width = header.num_slices;
+  height = num_rows * header.num_pixels;
+  size_t frame_size = header.num_strips * header.num_pixels * sizeof(ledscape_pixel_t);
+  printf("%u strips x %u pixels, %u slices per rotation; %u worker threads\n",
+      header.num_strips, header.num_pixels, header.num_slices, num_threads);
+
+  view_init();
+
+  // two buffers per worker keeps them all busy while the reader fills the next
+  for (unsigned int i = 0; i < num_threads * 2 + 1; i++) {
+    job_t *job = calloc(1, sizeof(*job));
+    job->equirect = malloc(width * height * 3);
+    job->next = free_jobs;
+    free_jobs = job;
+  }
+
+  pthread_t threads[num_threads];
+  for (unsigned int i = 0; i < num_threads; i++)
+    pthread_create(&threads[i], NULL, worker_func, NULL);
+
+  // stream the records, one rotation at a time
+  ledscape_frame_t *frame = malloc(frame_size);
+  ledscape_frame_t *last_frame = malloc(frame_size);
+  capture_record_t record, last_record;
+  bool have_last = false;
+  job_t *job = NULL;
+  uint64_t rotation_start_usec = 0;
+  uint64_t rotation_usec = 0;
+  uint64_t num_records = 0;
+  unsigned int num_rotations = 0;
+  unsigned int num_short_rotations = 0;
+  unsigned int num_emitted = 0;
+  unsigned int slices_in_rotation = 0;
+
+  uint64_t start_usec = 0;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  start_usec = ts.tv_sec * USEC_PER_SECOND + ts.tv_nsec / 1000;
+
+  while (true) {
+    bool eof = fread(&record, sizeof(record), 1, in) != 1
+        || fread(frame, frame_size, 1, in) != 1;
+    bool new_rotation = eof || !have_last || record.rotation != last_record.rotation;
+
+    if (have_last) {
+      // the previous frame stays lit until this one replaces it
+      unsigned int start, end;
+      if (by_timestamp) {
+        start = rotation_usec ? (last_record.timestamp_usec - rotation_start_usec) * width / rotation_usec : 0;
+        if (new_rotation)
+          end = rotation_usec && !eof ? (record.timestamp_usec - rotation_start_usec) * width / rotation_usec : start + 1;
+        else
+          end = rotation_usec ? (record.timestamp_usec - rotation_start_usec) * width / rotation_usec : start + 1;
+      } else {
+        // slices may be fewer or more than panel columns
+        start = last_record.slice_idx * width / last_record.num_slices;
+        end = new_rotation ? (last_record.slice_idx + 1) * width / last_record.num_slices
+            : record.slice_idx * width / record.num_slices;
+        if (end <= start)
+          end = start + 1;
+      }
+      if (start > width)
+        start = width;
+      if (end > width)
+        end = width;
+      if (job != NULL)
+        paint_frame(job->equirect, last_frame, start, end);
+    }
+
+    if (new_rotation) {
+      if (have_last) {
+        num_rotations++;
+        if (slices_in_rotation < last_record.num_slices)
+          num_short_rotations++;
+        if (job != NULL) {
+          submit_job(job);
+          num_emitted++;
+          job = NULL;
+        }
+      }
+      if (eof)
+        break;
+
+      if (have_last)
+        rotation_usec = record.timestamp_usec - rotation_start_usec;
+      rotation_start_usec = record.timestamp_usec;
+      slices_in_rotation = 0;
+
+      // without a measured period the first rotation cannot be placed by time
+      bool placeable = !by_timestamp || rotation_usec != 0;
+      if (placeable && num_rotations % every == 0) {
+        job = get_free_job();
+        job->rotation = record.rotation;
+        job->emit_idx = num_emitted;
+      }
+    }
+
+    slices_in_rotation++;
+    num_records++;
+    last_record = record;
+    ledscape_frame_t *tmp = last_frame;
+    last_frame = frame;
+    frame = tmp;
+    have_last = true;
+  }
+
+  pthread_mutex_lock(&queue_lock);
+  reading_done = true;
+  pthread_cond_broadcast(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+  for (unsigned int i = 0; i < num_threads; i++)
+    pthread_join(threads[i], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  double elapsed = (ts.tv_sec * USEC_PER_SECOND + ts.tv_nsec / 1000 - start_usec) / (double) USEC_PER_SECOND;
+  printf("%" PRIu64 " frames, %u rotations (%u with dropped slices), %u emitted in %.2f s\n",
+      num_records, num_rotations, num_short_rotations, num_emitted, elapsed);
+
+  fclose(in);
+  return 0;
+}
@@ -0,0 +1,311 @@
+/*
+ * Replays a session recorded with x2-display -r against a display server,
+ * as a repeatable load test of its ingest path.
+ *
+ * Every recorded connection is replayed on a framed connection of its own,
+ * with messages sent at their recorded times scaled by the speed, or as fast
+ * as the window of unanswered requests allows.  Reports messages and bytes
+ * per second and the reply latency.
+ *
+ * usage: x2-replay [-s speed | -m] [-w window] <record-file> <host> <port>
+ *
+ *   -s  playback speed, 2 for twice as fast (default 1, as recorded)
+ *   -m  send as fast as possible, ignoring the recorded times
+ *   -w  unanswered requests per connection (default 64, at most 1024)
+ */
+
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "constants.h"
+#include "protocol.h"
+#include "recorder.h"
+
+
+#define MAX_OPEN 4  // the server serves a few clients at once
+#define MAX_WINDOW 1024
+#define DEFAULT_WINDOW 64
+
+
+typedef struct {
+  uint32_t id;  // recorded connection
+  int fd;       // -1 if not open
+  uint64_t last_used;
+  uint16_t sent;
+  uint16_t received;
+  uint64_t sent_usec[MAX_WINDOW];
+} connection_t;
+
+
+const char *host;
+const char *port;
+unsigned int window = DEFAULT_WINDOW;
+
+connection_t connections[MAX_OPEN];
+uint64_t use_clock = 0;
+uint8_t *reply;
+size_t reply_size;
+
+uint32_t *latencies;
+size_t num_latencies;
+size_t latencies_size;
+uint64_t num_errors = 0;
+uint64_t num_connections = 0;
+
+
+void die(const char *msg) {
+  perror(msg);
+  exit(1);
+}
+
+uint64_t now_usec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * USEC_PER_SECOND + ts.tv_nsec / 1000;
+}
+
+void sleep_until_usec(uint64_t usec) {
+  struct timespec ts = { .tv_sec = usec / USEC_PER_SECOND, .tv_nsec = (usec % USEC_PER_SECOND) * 1000 };
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+void write_all(int fd, const uint8_t *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n <= 0)
+      die("write");
+    buf += n;
+    len -= n;
+  }
+}
+
+void read_all(int fd, uint8_t *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, buf, len);
+    if (n <= 0)
+      die("read");
+    buf += n;
+    len -= n;
+  }
+}
+
+int connect_server() {
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+  struct addrinfo *addrs;
+  int rc = getaddrinfo(host, port, &hints, &addrs);
+  if (rc != 0) {
+    fprintf(stderr, "%s: %s\n", host, gai_strerror(rc));
+    exit(1);
+  }
+
+  int fd = socket(addrs->ai_family, addrs->ai_socktype, addrs->ai_protocol);
+  if (fd < 0 || connect(fd, addrs->ai_addr, addrs->ai_addrlen) < 0)
+    die("connect");
+  freeaddrinfo(addrs);
+
+  uint8_t hello[X2_HELLO_SIZE];
+  memcpy(hello, X2_PROTOCOL_MAGIC, 4);
+  put_u16(hello + 4, X2_PROTOCOL_VERSION);
+  put_u16(hello + 6, 0);
+  write_all(fd, hello, sizeof(hello));
+  read_all(fd, hello, sizeof(hello));
+  if (memcmp(hello, X2_PROTOCOL_MAGIC, 4) != 0) {
+    fprintf(stderr, "server does not speak the framed protocol\n");
+    exit(1);
+  }
+
+  num_connections++;
+  return fd;
+}
+
+void add_latency(uint64_t usec) {
+  if (num_latencies == latencies_size) {
+    latencies_size = latencies_size ? 2 * latencies_size : 65536;
+    latencies = realloc(latencies, latencies_size * sizeof(uint32_t));
+    if (latencies == NULL)
+      die("realloc");
+  }
+  latencies[num_latencies++] = usec;
+}
+
+// read one reply, waiting for it, and time it against its request
+void read_reply(connection_t *conn) {
+  read_all(conn->fd, reply, X2_HEADER_SIZE);
+  uint32_t len = get_u32(reply);
+  uint16_t type = get_u16(reply + 4);
+  uint16_t seq = get_u16(reply + 6);
+  if (len > reply_size) {
+    fprintf(stderr, "reply too long: %" PRIu32 "\n", len);
+    exit(1);
+  }
+  read_all(conn->fd, reply, len);
+
+  if (type == X2_MSG_ERROR)
+    num_errors++;
+  add_latency(now_usec() - conn->sent_usec[seq % MAX_WINDOW]);
+  conn->received++;
+}
+
+// take the replies that have arrived, or all of them if wait
+void read_replies(connection_t *conn, bool wait) {
+  while (conn->received != conn->sent) {
+    if (!wait) {
+      struct pollfd fdset = { .fd = conn->fd, .events = POLLIN };
+      if (poll(&fdset, 1, 0) <= 0)
+        return;
+    }
+    read_reply(conn);
+  }
+}
+
+void close_connection(connection_t *conn) {
+  read_replies(conn, true);
+  close(conn->fd);
+  conn->fd = -1;
+}
+
+// the connection replaying a recorded one, opening it if need be
+connection_t *find_connection(uint32_t id) {
+  connection_t *lru = &connections[0];
+  for (int i = 0; i < MAX_OPEN; i++) {
+    connection_t *conn = &connections[i];
+    if (conn->fd >= 0 && conn->id == id)
+      return conn;
+    if (conn->fd < 0 || (lru->fd >= 0 && conn->last_used < lru->last_used))
+      lru = conn;
+  }
+
+  if (lru->fd >= 0)
+    close_connection(lru);
+  lru->id = id;
+  lru->fd = connect_server();
+  lru->sent = lru->received = 0;
+  return lru;
+}
+
+int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+uint32_t percentile(double pct) {
+  if (num_latencies == 0)
+    return 0;
+  size_t i = num_latencies * pct / 100;
+  return latencies[i < num_latencies ? i : num_latencies - 1];
+}
+
+void usage(char *name) {
+  fprintf(stderr, "usage: %s [-s speed | -m] [-w window] <record-file> <host> <port>\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  double speed = 1;
+  bool max_speed = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:mw:")) != -1) {
+    switch (opt) {
+    case 's':
+      speed = atof(optarg);
+      break;
+    case 'm':
+      max_speed = true;
+      break;
+    case 'w':
+      window = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 3 || speed <= 0 || window < 1 || window > MAX_WINDOW)
+    usage(argv[0]);
+  host = argv[optind + 1];
+  port = argv[optind + 2];
+
+  FILE *f = fopen(argv[optind], "rb");
+  if (f == NULL)
+    die(argv[optind]);
+  recorder_header_t header;
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, RECORDER_MAGIC, 4) != 0 ||
+      header.version != RECORDER_VERSION) {
+    fprintf(stderr, "%s: not a session recording, or a newer version\n", argv[optind]);
+    exit(1);
+  }
+
+  reply_size = header.panel_size > X2_MAX_SMALL_PAYLOAD ? header.panel_size : X2_MAX_SMALL_PAYLOAD;
+  reply = malloc(reply_size);
+  size_t request_size = X2_HEADER_SIZE + reply_size;
+  uint8_t *request = malloc(request_size);
+  if (reply == NULL || request == NULL)
+    die("malloc");
+  for (int i = 0; i < MAX_OPEN; i++)
+    connections[i].fd = -1;
+
+  uint64_t num_messages = 0;
+  uint64_t num_bytes = 0;
+  uint64_t start_usec = now_usec();
+
+  recorder_record_t record;
+  while (fread(&record, sizeof(record), 1, f) == 1) {
+    if (X2_HEADER_SIZE + record.length > request_size) {
+      // images can be larger than panels
+      request_size = X2_HEADER_SIZE + record.length;
+      request = realloc(request, request_size);
+      if (request == NULL)
+        die("realloc");
+    }
+    if (fread(request + X2_HEADER_SIZE, 1, record.length, f) != record.length) {
+      fprintf(stderr, "%s: truncated or corrupt at message %" PRIu64 "\n", argv[optind], num_messages);
+      break;
+    }
+
+    if (!max_speed)
+      sleep_until_usec(start_usec + record.timestamp_usec / speed);
+
+    connection_t *conn = find_connection(record.connection);
+    conn->last_used = ++use_clock;
+    if ((uint16_t) (conn->sent - conn->received) >= window)
+      read_reply(conn);
+
+    // renumber, so that replies can be matched to their send times
+    put_u32(request, record.length);
+    put_u16(request + 4, record.type);
+    put_u16(request + 6, conn->sent);
+    conn->sent_usec[conn->sent % MAX_WINDOW] = now_usec();
+    write_all(conn->fd, request, X2_HEADER_SIZE + record.length);
+    conn->sent++;
+
+    read_replies(conn, false);
+    num_messages++;
+    num_bytes += X2_HEADER_SIZE + record.length;
+  }
+  fclose(f);
+
+  for (int i = 0; i < MAX_OPEN; i++)
+    if (connections[i].fd >= 0)
+      close_connection(&connections[i]);
+  double secs = (double) (now_usec() - start_usec) / USEC_PER_SECOND;
+
+  qsort(latencies, num_latencies, sizeof(uint32_t), compare_u32);
+  printf("%" PRIu64 " messages, %" PRIu64 " bytes on %" PRIu64 " connections in %.3f s: "
+      "%.0f messages/s, %.1f MB/s\n",
+      num_messages, num_bytes, num_connections, secs, num_messages / secs, num_bytes / secs / 1e6);
+  printf("reply latency usec: p50 %" PRIu32 ", p99 %" PRIu32 ", p99.9 %" PRIu32 ", max %" PRIu32 "; %" PRIu64 " errors\n",
+      percentile(50), percentile(99), percentile(99.9), percentile(100), num_errors);
+
+  free(request);
+  free(reply);
+  free(latencies);
+  return 0;
+}
@@ -3,32 +3,73 @@
  * Listens on a specified port for image data, and displays that data to the
  * Orbital Rendersphere POV display.
  *
- * usage: x2-display <port>
+ * Clients either speak the framed protocol described in protocol.h over a
+ * persistent connection, or send a single legacy command per connection.
  */
 
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <poll.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include "calibration.h"
+#include "cluster.h"
+#include "compositor.h"
 #include "debug.h"
 #include "drawing.h"
+#include "effects.h"
 #include "err.h"
+#include "geometry.h"
+#include "metrics.h"
+#include "panel-cache.h"
+#include "protocol.h"
+#include "recorder.h"
+#include "resample.h"
+#include "strip-map.h"
+#include "text.h"
 #include "timing.h"
+#include "trace.h"
 
 
 #define POLL_TIMEOUT (3 * 1000)  // 3 seconds
 #define BUFSIZE 1024
+#define MAX_CLIENTS 8
+#define OUT_HIGH_WATER (256 * 1024)  // stop reading a client that does not read its replies
+
+
+typedef enum {
+  CLIENT_NEW,     // waiting for the first byte to tell framed from legacy
+  CLIENT_LEGACY,  // waiting for the rest of a legacy command
+  CLIENT_LEGACY_DONE,  // legacy, closed once the reply is sent
+  CLIENT_HELLO,   // framed, waiting for the hello
+  CLIENT_FRAMED,
+} client_state_t;
+
+typedef struct {
+  int fd;
+  uint32_t id;  // unique per connection, for recordings
+  client_state_t state;
+  uint8_t *in;
+  size_t in_len;
+  size_t in_size;
+  uint8_t *out;
+  size_t out_len;
+  size_t out_size;
+} client_t;
 
 
 // externs
 pthread_mutex_t lock;
 bool keepalive = true;
+bool reload = false;
 
 
 int socket_init(int portno) {
@@ -63,128 +104,489 @@ int socket_init(int portno) {
   return listenfd;
 }
 
-char *read_4bytes(int connfd) {
-  char buf[4];
-  int n = read(connfd, buf, 4);
-  if (n < 0) error("ERROR reading 4 bytes from socket");
-  return buf;
+// legacy clients send big-endian values
+uint32_t get_be32(const uint8_t *b) {
+  return ((uint32_t) b[0] << 24) + (b[1] << 16) + (b[2] << 8) + b[3];
+}
+
+// hand a received panel to the drawing thread
+void finish_panel(const uint8_t *panel, unsigned int len) {
+  if (!cluster_present(panel))
+    show_panel(panel);
+  trace_event(TRACE_SERVER, TRACE_PANEL_RECEIVED, 0, len);
+  metrics_add(&metrics.panels_received, 1);
+  metrics_add(&metrics.bytes_received, len);
+}
+
+uint32_t next_connection_id = 0;
+
+
+
+void encode_stats(uint8_t *p) {
+  ledscape_stats_t stats;
+  ledscape_stats(leds, &stats);
+
+  put_f64(p, rps); p += 8;
+  put_f64(p, fps); p += 8;
+  put_u32(p, slices_per_rotation); p += 4;
+  put_u32(p, slices_per_rotation ? rotation_usec / slices_per_rotation : 0); p += 4;
+  put_u64(p, stats.frames); p += 8;
+  put_u64(p, stats.overruns); p += 8;
+  const ledscape_hist_t *hists[] = { &stats.load, &stats.clock, &stats.reset, &stats.transfer };
+  for (int h = 0; h < 4; h++) {
+    put_u32(p, ledscape_hist_percentile(hists[h], 50)); p += 4;
+    put_u32(p, ledscape_hist_percentile(hists[h], 99)); p += 4;
+    put_u32(p, ledscape_hist_percentile(hists[h], 100)); p += 4;
+  }
+  put_u64(p, metrics_get(&metrics.panels_received)); p += 8;
+  put_u64(p, metrics_get(&metrics.deadline_misses));
+}
+
+// append len bytes to the client's output, to be sent when the socket allows
+uint8_t *add_output(client_t *client, size_t len) {
+  size_t need = client->out_len + len;
+  if (need > client->out_size) {
+    client->out_size = need * 2;
+    client->out = realloc(client->out, client->out_size);
+    if (client->out == NULL)
+      error("ERROR allocating client output");
+  }
+
+  uint8_t *p = client->out + client->out_len;
+  client->out_len = need;
+  return p;
+}
+
+uint8_t *add_reply(client_t *client, uint16_t type, uint16_t seq, uint32_t len) {
+  uint8_t *p = add_output(client, X2_HEADER_SIZE + len);
+  put_u32(p, len);
+  put_u16(p + 4, type);
+  put_u16(p + 6, seq);
+  return p + X2_HEADER_SIZE;
+}
+
+void add_error(client_t *client, uint16_t seq, const char *msg) {
+  memcpy(add_reply(client, X2_MSG_ERROR, seq, strlen(msg)), msg, strlen(msg));
+}
+
+void handle_message(client_t *client, uint16_t type, uint16_t seq, const uint8_t *payload, uint32_t len) {
+  uint16_t reply = type | X2_MSG_REPLY;
+
+  switch (type) {
+  case X2_MSG_PING:
+    memcpy(add_reply(client, reply, seq, len), payload, len);
+    break;
+  case X2_MSG_PANEL: {
+    uint8_t *panel = fill_panel();
+    memcpy(panel, payload, len);
+    memset(panel + len, 0, geometry.panel_size - len);
+    finish_panel(panel, len);
+    add_reply(client, reply, seq, 0);
+    break;
+  }
+  case X2_MSG_PANEL_STORE: {
+    uint64_t id;
+    if (!panel_cache_store(payload, len, &id)) {
+      add_error(client, seq, "panel cache is full or disabled");
+    } else {
+      put_u64(add_reply(client, reply, seq, 8), id);
+      metrics_add(&metrics.bytes_received, len);
+      if (coordinating)
+        cluster_send_panel(id, payload, len);
+    }
+    break;
+  }
+  case X2_MSG_PANEL_SHOW:
+    if (len != 8) {
+      add_error(client, seq, "show takes a u64 panel id");
+    } else if (!(coordinating ? cluster_present_cached(get_u64(payload)) : panel_cache_show(get_u64(payload)))) {
+      add_error(client, seq, "unknown panel id");
+    } else {
+      trace_event(TRACE_SERVER, TRACE_PANEL_RECEIVED, 0, 0);
+      metrics_add(&metrics.panels_received, 1);
+      add_reply(client, reply, seq, 0);
+    }
+    break;
+  case X2_MSG_X_OFFSET:
+    if (len != 4)
+      add_error(client, seq, "x offset takes a u32");
+    else
+      put_u32(add_reply(client, reply, seq, 4), set_x_offset(get_u32(payload)));
+    break;
+  case X2_MSG_BRIGHTNESS:
+    if (len != 4)
+      add_error(client, seq, "brightness takes an f32");
+    else
+      put_f32(add_reply(client, reply, seq, 4), set_brightness(get_f32(payload)));
+    break;
+  case X2_MSG_CONTRAST:
+    if (len != 4)
+      add_error(client, seq, "contrast takes an f32");
+    else
+      put_f32(add_reply(client, reply, seq, 4), set_contrast(get_f32(payload)));
+    break;
+  case X2_MSG_SPIN:
+    if (len != 8) {
+      add_error(client, seq, "spin takes two f32");
+    } else {
+      float velocity = get_f32(payload), acceleration = get_f32(payload + 4);
+      set_spin(&velocity, &acceleration);
+      uint8_t *p = add_reply(client, reply, seq, 8);
+      put_f32(p, velocity);
+      put_f32(p + 4, acceleration);
+    }
+    break;
+  case X2_MSG_IMAGE: {
+    uint8_t *panel = fill_panel();
+    if (len < X2_IMAGE_HEADER_SIZE ||
+        (uint64_t) get_u32(payload + 4) * get_u32(payload + 8) * 3 != len - X2_IMAGE_HEADER_SIZE ||
+        !resample(panel, payload[0], get_u32(payload + 4), get_u32(payload + 8), payload + X2_IMAGE_HEADER_SIZE)) {
+      add_error(client, seq, "bad image size or projection");
+    } else {
+      finish_panel(panel, len);
+      add_reply(client, reply, seq, 0);
+    }
+    break;
+  }
+  case X2_MSG_EFFECT: {
+    const uint8_t *end = memchr(payload, '\0', len < EFFECT_MAX_NAME ? len : EFFECT_MAX_NAME);
+    float params[EFFECT_MAX_PARAMS];
+    unsigned int num_params = end ? (len - (end + 1 - payload)) / 4 : 0;
+    if (end == NULL || (end + 1 - payload) + num_params * 4 != len || num_params > EFFECT_MAX_PARAMS) {
+      add_error(client, seq, "effect takes a name and up to 8 f32 parameters");
+      break;
+    }
+    for (unsigned int i = 0; i < num_params; i++)
+      params[i] = get_f32(end + 1 + i * 4);
+    if (effect_start((const char *) payload, params, num_params))
+      add_reply(client, reply, seq, 0);
+    else
+      add_error(client, seq, "unknown effect");
+    break;
+  }
+  case X2_MSG_LAYER:
+    if (len < X2_LAYER_HEADER_SIZE ||
+        (uint32_t) get_u16(payload + 12) * get_u16(payload + 14) * PIXEL_SIZE != len - X2_LAYER_HEADER_SIZE ||
+        !layer_set(payload[0], get_f32(payload + 4), get_f32(payload + 8),
+            get_u16(payload + 12), get_u16(payload + 14), payload + X2_LAYER_HEADER_SIZE))
+      add_error(client, seq, "bad layer number or size");
+    else
+      add_reply(client, reply, seq, 0);
+    break;
+  case X2_MSG_LAYER_MOVE:
+    if (len != X2_LAYER_MOVE_SIZE)
+      add_error(client, seq, "move takes a layer number, longitude and latitude");
+    else if (!layer_move(payload[0], get_f32(payload + 4), get_f32(payload + 8)))
+      add_error(client, seq, "no such layer");
+    else
+      add_reply(client, reply, seq, 0);
+    break;
+  case X2_MSG_LAYER_SCROLL:
+    if (len != X2_LAYER_SCROLL_SIZE)
+      add_error(client, seq, "scroll takes a layer number and speed");
+    else if (!layer_scroll(payload[0], get_f32(payload + 4)))
+      add_error(client, seq, "no such layer");
+    else
+      add_reply(client, reply, seq, 0);
+    break;
+  case X2_MSG_TEXT: {
+    if (len < X2_TEXT_HEADER_SIZE) {
+      add_error(client, seq, "text takes a style and a string");
+      break;
+    }
+    text_style_t style = {
+      .layer = payload[0], .scale = payload[1],
+      .longitude = get_f32(payload + 4), .latitude = get_f32(payload + 8),
+      .width = get_f32(payload + 12), .speed = get_f32(payload + 16),
+    };
+    memcpy(style.color, payload + 20, 4);
+    memcpy(style.background, payload + 24, 4);
+    if (text_layer(&style, (const char *) payload + X2_TEXT_HEADER_SIZE, len - X2_TEXT_HEADER_SIZE))
+      add_reply(client, reply, seq, 0);
+    else
+      add_error(client, seq, "bad layer number, scale, width or text length");
+    break;
+  }
+  case X2_MSG_STATS:
+    encode_stats(add_reply(client, reply, seq, X2_STATS_SIZE));
+    break;
+  default:
+    add_error(client, seq, "unknown message type");
+  }
+}
+
+/*
+ * Handle a legacy command once it is all in the client's input: one
+ * command, then the connection is closed.  It is recorded as the framed
+ * message that does the same.  Returns false if the command is unknown.
+ */
+bool handle_legacy(client_t *client) {
+  if (client->state == CLIENT_LEGACY_DONE) {
+    client->in_len = 0;  // anything after the command is ignored
+    return true;
+  }
+
+  const uint8_t *in = client->in;
+  char command = in[0];
+  uint8_t value[4];
+  if (command == '0') {
+    // panel data length in pixels, then the panel data
+    if (client->in_len < 5)
+      return true;
+    uint64_t len = (uint64_t) get_be32(in + 1) * 4;
+    if (len > geometry.panel_size)
+      len = geometry.panel_size;
+    if (client->in_len < 5 + len)
+      return true;
+#if DEBUG_SERVER
+    printf("length = %d\n", get_be32(in + 1));
+#endif
+
+    uint8_t *panel = fill_panel();
+    memcpy(panel, in + 5, len);
+    memset(panel + len, 0, geometry.panel_size - len);
+    if (recording)
+      recorder_message(client->id, X2_MSG_PANEL, 0, panel, len);
+    finish_panel(panel, len);
+  } else if (command == '?') {
+    // write rotations and frames per second back to the client; framed
+    // stats carry the rest
+    if (recording)
+      recorder_message(client->id, X2_MSG_STATS, 0, NULL, 0);
+    uint8_t *p = add_output(client, sizeof(rps) + sizeof(fps));
+    memcpy(p, &rps, sizeof(rps));
+    memcpy(p + sizeof(rps), &fps, sizeof(fps));
+  } else if (command == 'x' || command == 'b' || command == 'c') {
+    if (client->in_len < 5)
+      return true;
+    put_u32(value, get_be32(in + 1));
+    if (command == 'x') {
+      // x offset
+      if (recording)
+        recorder_message(client->id, X2_MSG_X_OFFSET, 0, value, 4);
+      set_x_offset(get_u32(value));
+    } else {
+      // brightness or contrast, as the big-endian bits of an IEEE float
+      uint16_t type = command == 'b' ? X2_MSG_BRIGHTNESS : X2_MSG_CONTRAST;
+      if (recording)
+        recorder_message(client->id, type, 0, value, 4);
+      if (command == 'b')
+        set_brightness(get_f32(value));
+      else
+        set_contrast(get_f32(value));
+    }
+  } else {
+    return false;
+  }
+
+  client->state = CLIENT_LEGACY_DONE;
+  client->in_len = 0;
+  return true;
+}
+
+/*
+ * Handle every complete message in the client's input.  Returns false if
+ * the client broke the protocol and should be dropped.
+ */
+bool handle_input(client_t *client) {
+  size_t pos = 0;
+  size_t need = 0;
+
+  if (client->state == CLIENT_LEGACY || client->state == CLIENT_LEGACY_DONE)
+    return handle_legacy(client);
+
+  if (client->state == CLIENT_HELLO) {
+    if (client->in_len < X2_HELLO_SIZE)
+      return true;
+    uint16_t version = get_u16(client->in + 4);
+    if (memcmp(client->in, X2_PROTOCOL_MAGIC, 4) != 0 || version < 1)
+      return false;
+    if (version > X2_PROTOCOL_VERSION)
+      version = X2_PROTOCOL_VERSION;
+
+    uint8_t *hello = client->out + client->out_len;
+    memcpy(hello, X2_PROTOCOL_MAGIC, 4);
+    put_u16(hello + 4, version);
+    put_u16(hello + 6, 0);
+    client->out_len += X2_HELLO_SIZE;
+    client->state = CLIENT_FRAMED;
+    pos = X2_HELLO_SIZE;
+  }
+
+  while (client->in_len - pos >= X2_HEADER_SIZE) {
+    const uint8_t *header = client->in + pos;
+    uint32_t len = get_u32(header);
+    uint16_t type = get_u16(header + 4);
+    uint16_t seq = get_u16(header + 6);
+
+    uint32_t max_len = X2_MAX_SMALL_PAYLOAD;
+    if (type == X2_MSG_PANEL || type == X2_MSG_PANEL_STORE)
+      max_len = geometry.panel_size;
+    else if (type == X2_MSG_IMAGE)
+      max_len = X2_IMAGE_HEADER_SIZE + max_image_size;
+    else if (type == X2_MSG_LAYER)
+      max_len = X2_LAYER_HEADER_SIZE + geometry.panel_size;
+    if (len > max_len)
+      return false;
+    if (client->in_len - pos < X2_HEADER_SIZE + len) {
+      need = X2_HEADER_SIZE + len;
+      break;
+    }
+
+    if (recording)
+      recorder_message(client->id, type, seq, header + X2_HEADER_SIZE, len);
+    handle_message(client, type, seq, header + X2_HEADER_SIZE, len);
+    pos += X2_HEADER_SIZE + len;
+  }
+
+  // keep any partial message at the front of the buffer
+  memmove(client->in, client->in + pos, client->in_len - pos);
+  client->in_len -= pos;
+
+  // and make room for all of it, if it is an image bigger than a panel
+  if (need > client->in_size) {
+    client->in_size = need;
+    client->in = realloc(client->in, client->in_size);
+    if (client->in == NULL)
+      error("ERROR allocating client input");
+  }
+  return true;
 }
 
-uint32_t read_uint32(int connfd) {
-  char *b = read_4bytes(connfd);
-  return (b[0] << 24) + (b[1] << 16) + (b[2] << 8) + b[3];
+void client_open(client_t *client, int connfd) {
+  fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+  client->fd = connfd;
+  client->id = next_connection_id++;
+  client->state = CLIENT_NEW;
+  client->in_len = 0;
+  client->in_size = X2_HEADER_SIZE + (geometry.panel_size > X2_MAX_SMALL_PAYLOAD ? geometry.panel_size : X2_MAX_SMALL_PAYLOAD);
+  client->in = malloc(client->in_size);
+  client->out_len = 0;
+  client->out_size = BUFSIZE;
+  client->out = malloc(client->out_size);
+  if (client->in == NULL || client->out == NULL)
+    error("ERROR allocating client buffers");
 }
 
-float read_float(int connfd) {
-  char *b = read_4bytes(connfd);
-  return (b[0] << 24) + (b[1] << 16) + (b[2] << 8) + b[3];
+void client_close(client_t *client) {
+  close(client->fd);
+  free(client->in);
+  free(client->out);
+  client->fd = -1;
+  client->out_len = 0;
 }
 
-void write_stats(int connfd) {
-  // write rotations per second back to client
-  int n = write(connfd, &rps, sizeof(rps));
-  if (n < 0)
-    error("ERROR writing RPS to socket");
+/*
+ * Service a client whose socket is ready.  Returns false once the client
+ * should be closed.
+ */
+bool client_ready(client_t *client, short revents) {
+  if (client->state == CLIENT_NEW && (revents & POLLIN)) {
+    char first;
+    int n = recv(client->fd, &first, 1, MSG_PEEK);
+    if (n <= 0)
+      return false;
+    // legacy commands are read into the buffer like framed messages, so a
+    // slow legacy client holds up no one else
+    client->state = first == X2_PROTOCOL_MAGIC[0] ? CLIENT_HELLO : CLIENT_LEGACY;
+  }
+
+  if (revents & POLLIN) {
+    int n = read(client->fd, client->in + client->in_len, client->in_size - client->in_len);
+    if (n == 0 || (n < 0 && errno != EAGAIN))
+      return false;
+    if (n > 0) {
+      client->in_len += n;
+      if (!handle_input(client))
+        return false;
+    }
+  }
 
-  // write frames per second back to client
-  n = write(connfd, &fps, sizeof(fps));
-  if (n < 0)
-    error("ERROR writing FPS to socket");
+  if (client->out_len > 0) {
+    int n = send(client->fd, client->out, client->out_len, MSG_NOSIGNAL);
+    if (n < 0)
+      return errno == EAGAIN;
+    memmove(client->out, client->out + n, client->out_len - n);
+    client->out_len -= n;
+  }
+
+  if (client->state == CLIENT_LEGACY_DONE && client->out_len == 0)
+    return false;
+  return !(revents & (POLLHUP | POLLERR));
 }
 
 void *server_func(int port) {
   printf("Server listening on port %d\n", port);
   int listenfd = socket_init(port);
 
-  struct sockaddr_in clientaddr;
-  socklen_t clientlen = sizeof(clientaddr);
+  client_t clients[MAX_CLIENTS];
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    clients[i].fd = -1;
+    clients[i].out_len = 0;
+  }
 
-  struct pollfd fdset[1];
-  memset((void*)fdset, 0, sizeof(fdset));
-  fdset[0].fd = listenfd;
-  fdset[0].events = POLLIN;
+  // fdset[0] is the listening socket, fdset[i + 1] is clients[i], and
+  // fdset[MAX_CLIENTS + 1] is the cluster socket
+  struct pollfd fdset[MAX_CLIENTS + 2];
 
   while (keepalive) {
-    // poll: wait for a connection request
-    poll(fdset, 1, POLL_TIMEOUT);
+    // reload the files that can change under a running display
+    if (reload) {
+      reload = false;
+      calibration_load();
+      strip_map_load();
+    }
+
+    memset((void*)fdset, 0, sizeof(fdset));
+    fdset[0].fd = listenfd;
+    fdset[0].events = POLLIN;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+      fdset[i + 1].fd = clients[i].fd;
+      if (clients[i].out_len < OUT_HIGH_WATER)
+        fdset[i + 1].events |= POLLIN;
+      if (clients[i].fd >= 0 && clients[i].out_len > 0)
+        fdset[i + 1].events |= POLLOUT;
+    }
+    fdset[MAX_CLIENTS + 1].fd = cluster_fd();
+    fdset[MAX_CLIENTS + 1].events = POLLIN;
+
+    // poll: wait for a connection request, client data or a cluster event
+    int ready = poll(fdset, MAX_CLIENTS + 2, cluster_timeout(POLL_TIMEOUT));
+    cluster_handle(ready > 0 && (fdset[MAX_CLIENTS + 1].revents & POLLIN));
+    if (ready <= 0)
+      continue;
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+      if (clients[i].fd >= 0 && fdset[i + 1].revents && !client_ready(&clients[i], fdset[i + 1].revents))
+        client_close(&clients[i]);
+    }
 
-    if (fdset[0].revents == POLLIN) {
+    if (fdset[0].revents & POLLIN) {
 #if DEBUG_SERVER
       printf("Received connection\n");
 #endif
 
       // accept connection request
-      int connfd = accept(fdset[0].fd, (struct sockaddr *) &clientaddr, &clientlen);
+      int connfd = accept(listenfd, NULL, NULL);
       if (connfd < 0)
         error("ERROR on accept");
+      metrics_add(&metrics.connections, 1);
 
-      // read command
-      int n;
-      char command;
-      n = read(connfd, &command, 1);
-      if (n < 0)
-	error("ERROR reading command from socket");
-      if (command == '0') {
-        // read panel data length
-        uint32_t datalen = read_uint32(connfd);
-#if DEBUG_SERVER
-        printf("length = %d\n", datalen);
-#endif
-
-        // determine fill index
-        pthread_mutex_lock(&lock);
-        if (draw_idx == 0 || to_draw_idx == 0)
-          if (draw_idx == 1 || to_draw_idx == 1)
-            fill_idx = 2;
-          else
-            fill_idx = 1;
-        else
-          fill_idx = 0;
-        pthread_mutex_unlock(&lock);
-
-        // read panel data from the client
-        bzero(panels[fill_idx], PANEL_SIZE);
-        unsigned int offset = 0;
-        while (offset < datalen * 4) {
-          n = read(connfd, panels[fill_idx] + offset, BUFSIZE);
-          if (n < 0) error("ERROR reading panel data from socket");
-          offset += n;
-        }
-
-        // set to-draw index
-        pthread_mutex_lock(&lock);
-        to_draw_idx = fill_idx;
-        pthread_mutex_unlock(&lock);
-
-        // write stats back to client
-//        write_stats(connfd);
-      } else if (command == '?') {
-        // write stats back to client
-        write_stats(connfd);
-      } else if (command == 'x') {
-        // x offset
-        uint32_t value = set_x_offset(read_uint32(connfd));
-//	n = write(connfd, &value, sizeof(value));
-//	if (n < 0)
-//	  error("ERROR writing x offset value to socket");
-      } else if (command == 'b') {
-        // read brightness
-        float value = set_brightness(read_float(connfd));
-//	n = write(connfd, &value, sizeof(value));
-//	if (n < 0)
-//	  error("ERROR writing brightness value to socket");
-      } else if (command == 'c') {
-        // read contrast
-        float value = set_contrast(read_float(connfd));
-//	n = write(connfd, &value, sizeof(value));
-//	if (n < 0)
-//	  error("ERROR writing contrast value to socket");
+      int i = 0;
+      while (i < MAX_CLIENTS && clients[i].fd >= 0)
+        i++;
+      if (i == MAX_CLIENTS) {
+        fprintf(stderr, "Too many clients, dropping connection\n");
+        close(connfd);
+      } else {
+        client_open(&clients[i], connfd);
       }
-
-      close(connfd);
     }
   }
 
+  for (int i = 0; i < MAX_CLIENTS; i++)
+    if (clients[i].fd >= 0)
+      client_close(&clients[i]);
   close(listenfd);
 
   printf("Exiting server thread\n");
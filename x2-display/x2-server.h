@@ -7,8 +7,10 @@
 
 extern pthread_mutex_t lock;
 extern bool keepalive;
+extern bool reload;  // set on SIGHUP
 
 
+extern int socket_init(int port);
 extern void *server_func(int port);
 
 